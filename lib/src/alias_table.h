@@ -0,0 +1,228 @@
+#pragma once
+
+#include "utils.h"
+#include "permutation.h"
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace nvme_sampler {
+
+/**
+ * Record of a weights file: rows [first_row, first_row of the next record) are sampled with relative probability weight
+ * (rows before the first record are never sampled). Records must be sorted by first_row; row indices are global, i.e. rows of
+ * the first shard go first.
+ *
+ * numpy: np.array(records, dtype=[("first_row", "<i8"), ("weight", "<f8")]).tofile(path)
+ */
+struct WeightRange {
+    int64 first_row;
+    double weight;
+};
+
+static_assert(sizeof(WeightRange) == 16, "WeightRange must match the file format");
+
+/**
+ * Walker/Vose alias table: samples index i with probability weights[i] / sum(weights) in O(1).
+ *
+ * Tables are built once per (weights file, shard, chunk size) and cached in a file next to the weights file, which is then
+ * memory-mapped, so starting a sampler on a multi-TiB dataset costs a few page faults rather than a rebuild.
+ */
+class AliasTable {
+public:
+    struct Entry {
+        float probability; // of keeping the index drawn uniformly (otherwise alias is returned)
+        uint32_t alias;
+    };
+
+private:
+    struct Header {
+        uint64 magic;
+        uint64 source_hash; // of everything the table is built from
+        int64 num_entries;
+        double total_weight;
+    };
+
+    static const uint64 MAGIC = 0x31534149414c414eULL; // "NALAIAS1"
+
+    MappedFile mapping;
+    Header const *header{nullptr};
+    Entry const *entries{nullptr};
+
+public:
+    /**
+     * Opens a cached table for num_chunks chunks of chunk_size_b bytes of a shard starting at global row first_row,
+     * building (and caching) it if needed. Chunk weight is the total weight of rows starting in the chunk.
+     */
+    AliasTable(std::string const &weights_path, std::string const &cache_path, int64 first_row, int64 num_rows,
+               int64 row_size_b, int64 num_chunks, int64 chunk_size_b) {
+        CASSERT(num_chunks > 0 && num_chunks <= (1LL << 32), "too many chunks for alias table: %ld", num_chunks);
+
+        struct stat weights_stat;
+        CHECK_SYSCALL(::stat(weights_path.c_str(), &weights_stat) == 0, "Cannot read weights file: " << weights_path);
+        uint64 source_hash = MAGIC;
+        for (int64 value : {static_cast<int64>(weights_stat.st_size), static_cast<int64>(weights_stat.st_mtim.tv_sec),
+                            static_cast<int64>(weights_stat.st_mtim.tv_nsec), first_row, num_rows, row_size_b, num_chunks,
+                            chunk_size_b}) {
+            source_hash = mix64(source_hash ^ static_cast<uint64>(value));
+        }
+
+        if (!this->open_cached(cache_path, source_hash, num_chunks)) {
+            this->build(weights_path, cache_path, source_hash, first_row, num_rows, row_size_b, num_chunks, chunk_size_b);
+            CASSERT(this->open_cached(cache_path, source_hash, num_chunks), "Failed to build alias table %s", cache_path.c_str());
+        }
+    }
+
+    AliasTable(AliasTable const &) = delete;
+
+    AliasTable &operator=(AliasTable const &) = delete;
+
+    double get_total_weight() const {
+        return this->header->total_weight;
+    }
+
+    // random: 64 uniformly distributed bits
+    inline int64 sample(uint64 random) const {
+        const uint64 idx = ((random >> 32) * static_cast<uint64>(this->header->num_entries)) >> 32;
+        const float coin = static_cast<float>(random & 0xffffffffULL) * (1.0f / 4294967296.0f);
+        Entry const &entry = this->entries[idx];
+        return coin < entry.probability ? static_cast<int64>(idx) : static_cast<int64>(entry.alias);
+    }
+
+private:
+    bool open_cached(std::string const &cache_path, uint64 source_hash, int64 num_chunks) {
+        if (this->header != nullptr) {
+            return true; // built in anonymous memory
+        }
+
+        MappedFile mapping;
+        if (!mapping.open(cache_path) || mapping.get_size() != static_cast<int64>(sizeof(Header) + sizeof(Entry) * num_chunks)) {
+            return false;
+        }
+        Header const *header = mapping.data<Header>();
+        if (header->magic != MAGIC || header->source_hash != source_hash || header->num_entries != num_chunks) {
+            return false;
+        }
+
+        this->mapping.swap(mapping);
+        this->header = header;
+        this->entries = reinterpret_cast<Entry const *>(header + 1);
+        return true;
+    }
+
+    void build(std::string const &weights_path, std::string const &cache_path, uint64 source_hash, int64 first_row,
+               int64 num_rows, int64 row_size_b, int64 num_chunks, int64 chunk_size_b) {
+        MappedFile weights_file;
+        const bool opened = weights_file.open(weights_path);
+        CASSERT(opened, "weights file %s does not exist", weights_path.c_str());
+        CASSERT(weights_file.get_size() % sizeof(WeightRange) == 0, "invalid size of weights file %s", weights_path.c_str());
+        WeightRange const *ranges = weights_file.data<WeightRange>();
+        const int64 num_ranges = weights_file.get_size() / static_cast<int64>(sizeof(WeightRange));
+
+        // the table is written into a temporary file (or anonymous memory if the directory is read-only) and renamed
+        const int64 table_size_b = static_cast<int64>(sizeof(Header) + sizeof(Entry) * num_chunks);
+        const std::string tmp_path = cache_path + ".tmp" + std::to_string(::getpid());
+        const int32 file_descriptor = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        void *address;
+        if (file_descriptor >= 0) {
+            CHECK_SYSCALL(::ftruncate(file_descriptor, table_size_b) == 0, "ftruncate() failed: " << tmp_path);
+            address = ::mmap(nullptr, table_size_b, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+        } else {
+            LOG("Cannot create " << tmp_path << " (errno: " << errno << "), alias table will not be cached");
+            address = ::mmap(nullptr, table_size_b, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        CHECK_SYSCALL(address != MAP_FAILED, "mmap() failed");
+
+        Header *header = reinterpret_cast<Header *>(address);
+        Entry *entries = reinterpret_cast<Entry *>(header + 1);
+        const double total_weight = compute_chunk_weights(ranges, num_ranges, first_row, num_rows, row_size_b, num_chunks,
+                                                          chunk_size_b, entries);
+        build_vose(entries, num_chunks, total_weight);
+        *header = Header{.magic = MAGIC, .source_hash = source_hash, .num_entries = num_chunks, .total_weight = total_weight};
+
+        if (file_descriptor >= 0) {
+            CHECK_SYSCALL(::munmap(address, table_size_b) == 0, "munmap() failed");
+            CHECK_SYSCALL(::close(file_descriptor) == 0, "Failed to close file: " << tmp_path);
+            CHECK_SYSCALL(::rename(tmp_path.c_str(), cache_path.c_str()) == 0, "Failed to rename " << tmp_path);
+            LOG("Alias table cached in " << cache_path);
+        } else {
+            CHECK_SYSCALL(::mprotect(address, table_size_b, PROT_READ) == 0, "mprotect() failed");
+            MappedFile mapping(address, table_size_b);
+            this->mapping.swap(mapping);
+            this->header = header;
+            this->entries = entries;
+        }
+    }
+
+    // stores weight of every chunk in entries[chunk_idx].probability; returns the total weight
+    static double compute_chunk_weights(WeightRange const *ranges, int64 num_ranges, int64 first_row, int64 num_rows,
+                                        int64 row_size_b, int64 num_chunks, int64 chunk_size_b, Entry *entries) {
+        for (int64 range_idx = 0; range_idx < num_ranges; ++range_idx) {
+            CASSERT(ranges[range_idx].first_row >= 0 && (range_idx == 0 || ranges[range_idx].first_row > ranges[range_idx - 1].first_row),
+                    "weight ranges must be sorted by first_row (record %ld)", range_idx);
+            CASSERT(std::isfinite(ranges[range_idx].weight) && ranges[range_idx].weight >= 0,
+                    "invalid weight of record %ld: %f", range_idx, ranges[range_idx].weight);
+        }
+
+        // chunk reads take rows starting in [chunk_idx * chunk_size_b, (chunk_idx + 1) * chunk_size_b)
+        double total_weight = 0;
+        int64 range_idx = -1;
+        int64 row = first_row;
+        for (int64 chunk_idx = 0; chunk_idx < num_chunks; ++chunk_idx) {
+            const int64 end_row = first_row + std::min(num_rows, ((chunk_idx + 1) * chunk_size_b + row_size_b - 1) / row_size_b);
+            double chunk_weight = 0;
+            while (row < end_row) {
+                while (range_idx + 1 < num_ranges && ranges[range_idx + 1].first_row <= row) {
+                    ++range_idx;
+                }
+                const int64 range_end = range_idx + 1 < num_ranges ? ranges[range_idx + 1].first_row : end_row;
+                const int64 next_row = std::min(end_row, range_end);
+                chunk_weight += range_idx < 0 ? 0 : ranges[range_idx].weight * static_cast<double>(next_row - row);
+                row = next_row;
+            }
+            entries[chunk_idx].probability = static_cast<float>(chunk_weight);
+            total_weight += chunk_weight;
+        }
+        return total_weight;
+    }
+
+    // Vose's method; on input entries[i].probability holds weight of i
+    static void build_vose(Entry *entries, int64 num_entries, double total_weight) {
+        std::vector<uint32_t> small, large;
+        std::vector<double> scaled(num_entries);
+        for (int64 idx = 0; idx < num_entries; ++idx) {
+            scaled[idx] = total_weight > 0 ? entries[idx].probability * num_entries / total_weight : 1.0;
+            (scaled[idx] < 1.0 ? small : large).push_back(static_cast<uint32_t>(idx));
+        }
+
+        while (!small.empty() && !large.empty()) {
+            const uint32_t small_idx = small.back();
+            const uint32_t large_idx = large.back();
+            small.pop_back();
+
+            entries[small_idx] = Entry{.probability = static_cast<float>(scaled[small_idx]), .alias = large_idx};
+            scaled[large_idx] -= 1.0 - scaled[small_idx];
+            if (scaled[large_idx] < 1.0) {
+                large.pop_back();
+                small.push_back(large_idx);
+            }
+        }
+
+        // leftovers differ from 1 only by rounding errors
+        for (std::vector<uint32_t> const *indices : {&small, &large}) {
+            for (uint32_t idx : *indices) {
+                entries[idx] = Entry{.probability = 1.0f, .alias = idx};
+            }
+        }
+    }
+};
+
+}
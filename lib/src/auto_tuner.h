@@ -0,0 +1,243 @@
+#pragma once
+
+#include "utils.h"
+#include "stats.h"
+#include "worker.h"
+
+#include <mutex>
+#include <vector>
+
+namespace nvme_sampler {
+
+/**
+ * Online tuning of worker concurrency (SamplerConfig::auto_tune): hill climbing over the queue depth of workers and the
+ * number of active workers of every pool, driven by samples read per second and the median read latency.
+ *
+ * step() is called between batch blocks; at most every MIN_INTERVAL_NS it measures the interval since the previous step.
+ * One interval tries a move (doubling or halving the queue depth, one more or one less active worker per pool), the next
+ * one decides whether to keep it:
+ * - any move is kept if the sample rate grew by at least MIN_GAIN;
+ * - a move to less concurrency is also kept if the rate held (within MAX_LOSS) and either workers were idle for at least
+ *   IDLE_FRACTION of the time before it (the consumer is the bottleneck) or the median latency dropped by at least MIN_GAIN
+ *   (reads were just queueing up on a saturated device).
+ * Moves to more concurrency are not tried while workers are that idle. A kept move is tried once more, a rejected one is
+ * reverted and the next one is tried; once all of them were rejected in a row, tuning pauses for HOLD_STEPS steps (the load
+ * may change later).
+ *
+ * Concurrency starts at its maximum and never exceeds it, so read buffers allocated up front cover every setting and
+ * memory use stays within memory_usage_limit_b. Chunk size is not tuned: chunks make up the batch sequence of a seed
+ * (and checkpoints, epoch permutations and alias tables refer to them).
+ */
+class AutoTuner {
+    static const int64 MIN_INTERVAL_NS = 200 * 1000 * 1000;
+    static const int32 MIN_QUEUE_DEPTH = 4;
+    static const int32 HOLD_STEPS = 25;
+    static constexpr double MIN_GAIN = 0.05;
+    static constexpr double MAX_LOSS = 0.02;
+    static constexpr double IDLE_FRACTION = 0.2;
+
+    enum MoveType {
+        DeeperQueuesMove = 0,
+        MoreWorkersMove = 1,
+        ShallowerQueuesMove = 2,
+        FewerWorkersMove = 3,
+        NUM_MOVES = 4,
+        NoMove = 5
+    };
+
+    const std::vector<PoolConcurrency *> pools;
+    const std::vector<WorkerCounters const *> worker_counters;
+    const int32 max_queue_depth;
+    const int32 min_queue_depth;
+    const int64 max_num_active_workers; // size of the largest pool
+
+    std::mutex mutex;
+    int32 queue_depth;
+    int64 num_active_workers; // per pool (pools smaller than that run all their workers)
+
+    // counters at the previous step
+    int64 last_time_ns{monotonic_time_ns()};
+    int64 last_samples_read{0};
+    int64 last_idle_ns{0};
+    LatencySummary last_latency{};
+
+    // move on trial, the setting and the interval before it
+    MoveType trial{NoMove};
+    int32 base_queue_depth{0};
+    int64 base_num_active_workers{0};
+    double base_rate{0};
+    int64 base_latency_ns{0};
+    double base_idle_fraction{0};
+
+    int32 next_move{ShallowerQueuesMove};
+    int32 num_rejected{0}; // in a row
+    int32 num_hold_steps{0};
+
+public:
+    AutoTuner(std::vector<PoolConcurrency *> const &pools, std::vector<WorkerCounters const *> const &worker_counters,
+              int32 max_queue_depth)
+            : pools(pools),
+              worker_counters(worker_counters),
+              max_queue_depth(max_queue_depth),
+              min_queue_depth(std::min(static_cast<int32>(MIN_QUEUE_DEPTH), max_queue_depth)),
+              max_num_active_workers(get_max_pool_size(pools)),
+              queue_depth(max_queue_depth),
+              num_active_workers(max_num_active_workers) {}
+
+    // may be called from any thread; returns at once if another thread is taking a step
+    void step() {
+        std::unique_lock<std::mutex> lock(this->mutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            return;
+        }
+
+        const int64 now_ns = monotonic_time_ns();
+        const int64 interval_ns = now_ns - this->last_time_ns;
+        if (interval_ns < MIN_INTERVAL_NS) {
+            return;
+        }
+
+        int64 samples_read = 0;
+        int64 idle_ns = 0;
+        LatencySummary latency;
+        for (auto const counters : this->worker_counters) {
+            samples_read += counters->samples_read.get();
+            idle_ns += counters->idle_ns.get();
+            latency.add(counters->io_latency);
+
+            // a worker may wait for work for many intervals: its wait so far belongs to this one
+            const int64 idle_since_ns = counters->idle_since_ns.get();
+            if (idle_since_ns > 0) {
+                idle_ns += now_ns - idle_since_ns;
+            }
+        }
+        const int64 num_samples = samples_read - this->last_samples_read;
+        const int64 num_idle_ns = idle_ns - this->last_idle_ns;
+        LatencySummary interval_latency = latency;
+        interval_latency.subtract(this->last_latency);
+
+        this->last_time_ns = now_ns;
+        this->last_samples_read = samples_read;
+        this->last_idle_ns = idle_ns;
+        this->last_latency = latency;
+        if (num_samples == 0) {
+            return; // nothing was read (e.g. all blocks wait for the consumer), nothing to learn from
+        }
+
+        const double rate = num_samples * 1e9 / interval_ns;
+        const int64 latency_ns = interval_latency.quantile_ns(0.5);
+        // negative only if the previous step counted a wait both as ongoing and as ended (they are updated one by one)
+        const double idle_fraction = std::max(0.0, static_cast<double>(num_idle_ns) / (this->get_num_active_workers() * interval_ns));
+
+        if (this->trial != NoMove) {
+            this->finish_trial(rate, latency_ns);
+        } else if (this->num_hold_steps > 0) {
+            --this->num_hold_steps;
+        } else {
+            this->start_trial(rate, latency_ns, idle_fraction);
+        }
+    }
+
+    // in all pools
+    int64 get_num_active_workers() const {
+        int64 num_active_workers = 0;
+        for (auto const pool : this->pools) {
+            num_active_workers += pool->get_num_active_workers();
+        }
+        return num_active_workers;
+    }
+
+private:
+    static int64 get_max_pool_size(std::vector<PoolConcurrency *> const &pools) {
+        int64 max_pool_size = 0;
+        for (auto const pool : pools) {
+            max_pool_size = std::max(max_pool_size, pool->num_workers);
+        }
+        return max_pool_size;
+    }
+
+    // consumer_bound: more concurrency would only make workers wait longer
+    bool is_possible(int32 move, bool consumer_bound) const {
+        switch (move) {
+            case DeeperQueuesMove:
+                return !consumer_bound && this->queue_depth < this->max_queue_depth;
+            case MoreWorkersMove:
+                return !consumer_bound && this->num_active_workers < this->max_num_active_workers;
+            case ShallowerQueuesMove:
+                return this->queue_depth > this->min_queue_depth;
+            case FewerWorkersMove:
+                return this->num_active_workers > 1;
+            default:
+                return false;
+        }
+    }
+
+    void start_trial(double rate, int64 latency_ns, double idle_fraction) {
+        for (int32 move_idx = 0; move_idx < NUM_MOVES; ++move_idx) {
+            const int32 move = (this->next_move + move_idx) % NUM_MOVES;
+            if (this->is_possible(move, idle_fraction >= IDLE_FRACTION)) {
+                this->trial = static_cast<MoveType>(move);
+                this->base_queue_depth = this->queue_depth;
+                this->base_num_active_workers = this->num_active_workers;
+                this->base_rate = rate;
+                this->base_latency_ns = latency_ns;
+                this->base_idle_fraction = idle_fraction;
+                this->apply(this->trial);
+                return;
+            }
+        }
+        this->num_hold_steps = HOLD_STEPS; // the least concurrency and the consumer is the bottleneck (or nothing can change)
+    }
+
+    void finish_trial(double rate, int64 latency_ns) {
+        const bool less_concurrency = this->trial == ShallowerQueuesMove || this->trial == FewerWorkersMove;
+        const bool faster = rate >= this->base_rate * (1 + MIN_GAIN);
+        const bool rate_held = rate >= this->base_rate * (1 - MAX_LOSS);
+        const bool lower_latency = latency_ns <= this->base_latency_ns * (1 - MIN_GAIN);
+
+        if (faster || (less_concurrency && rate_held && (this->base_idle_fraction >= IDLE_FRACTION || lower_latency))) {
+            LOG("Auto-tuner: queue depth " << this->queue_depth << ", " << this->num_active_workers << " active workers per pool ("
+                                           << static_cast<int64>(rate) << " samples/s, median read latency " << latency_ns / 1000 << " us)");
+            this->next_move = this->trial;
+            this->num_rejected = 0;
+        } else {
+            this->set(this->base_queue_depth, this->base_num_active_workers);
+            this->next_move = (this->trial + 1) % NUM_MOVES;
+            if (++this->num_rejected >= NUM_MOVES) {
+                this->num_rejected = 0;
+                this->num_hold_steps = HOLD_STEPS;
+            }
+        }
+        this->trial = NoMove;
+    }
+
+    void apply(MoveType move) {
+        switch (move) {
+            case DeeperQueuesMove:
+                this->set(std::min(this->queue_depth * 2, this->max_queue_depth), this->num_active_workers);
+                break;
+            case MoreWorkersMove:
+                this->set(this->queue_depth, this->num_active_workers + 1);
+                break;
+            case ShallowerQueuesMove:
+                this->set(std::max(this->queue_depth / 2, this->min_queue_depth), this->num_active_workers);
+                break;
+            case FewerWorkersMove:
+                this->set(this->queue_depth, this->num_active_workers - 1);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void set(int32 queue_depth, int64 num_active_workers) {
+        this->queue_depth = queue_depth;
+        this->num_active_workers = num_active_workers;
+        for (auto pool : this->pools) {
+            pool->set_queue_depth(queue_depth);
+            pool->set_num_active_workers(num_active_workers);
+        }
+    }
+};
+
+}
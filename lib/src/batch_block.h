@@ -2,27 +2,42 @@
 
 #include "calculator.h"
 #include "utils.h"
+#include "pages.h"
+#include "ring_queue.h"
 
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
 #include <cstddef>
 #include <vector>
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
 
 namespace nvme_sampler {
 
 using SamplingParametersCalculator::PAGE_SIZE;
 
 struct BatchBlock {
+    const int32_t block_idx;
     const int64_t element_size_b;
     const int64_t num_samples;
-    int64_t read_idx = 0; // index of next element to read
+    std::atomic<int64_t> read_idx{0}; // index of next element to read, claimed by consumers with fetch_add
+    int64_t epoch = 0; // epoch of the oldest chunk read into the block (EpochSamplingMode)
+    int64_t sequence_number = 0; // of the last filling of the block; random streams of workers and the order of blocks follow it
+    // held by the sampler while it hands out the block, by every consumer reading it and by every leased batch;
+    // the last one hands the block to workers
+    std::atomic<int32_t> num_references{0};
     Buffer buffer{.size =  0, .buffer = NULL};
 
     BatchBlock(BatchBlock const &other) = delete;
 
     BatchBlock &operator=(BatchBlock const &) = delete;
 
-    BatchBlock(int64_t element_size_b, int64_t num_samples, byte *buffer_address) :
+    BatchBlock(int32_t block_idx, int64_t element_size_b, int64_t num_samples, byte *buffer_address) :
+            block_idx(block_idx),
             element_size_b(element_size_b),
             num_samples(num_samples),
             buffer(Buffer{
@@ -31,45 +46,158 @@ struct BatchBlock {
                     .buffer = align_up_ptr(buffer_address, PAGE_SIZE)
             }) {}
 
+    // negative once claims of concurrent consumers overshoot the end of the block
     int64_t get_num_samples_left() const {
-        return this->num_samples - this->read_idx;
+        return this->num_samples - this->read_idx.load(std::memory_order_relaxed);
     }
 
-    byte *read_next_batch(int32_t batch_size) {
-        ASSERT(this->get_num_samples_left() >= batch_size, "%ld", this->get_num_samples_left());
-
-        byte *buf = this->buffer.buffer + (read_idx * element_size_b);
-        this->read_idx += batch_size;
-
-        return buf;
+    // returns nullptr if fewer than batch_size + 1 samples are left (the claim still moves read_idx)
+    byte *claim_next_batch(int32_t batch_size) {
+        const int64_t read_idx = this->read_idx.fetch_add(batch_size, std::memory_order_relaxed);
+        if (this->num_samples - read_idx <= batch_size) {
+            return nullptr;
+        }
+        return this->buffer.buffer + read_idx * this->element_size_b;
     }
 };
 
 typedef BatchBlock *BatchBlockPtr;
 
+/**
+ * Queue of filled batch blocks waiting for the consumer.
+ *
+ * Blocks are queued in the order of their sequence numbers: a block filled before the ones scheduled earlier waits in
+ * out_of_order_blocks, so consumers see the same sequence of blocks however workers are scheduled.
+ *
+ * Consumers wait for blocks by polling the eventfd, a semaphore counting queued blocks plus the popped block consumers read
+ * until it is retired (see retire()). It stays readable while a batch may be available, so a consumer sleeping in poll()
+ * wakes up even when another consumer takes the last queued block. The optional callback is called by the worker that
+ * finished a block.
+ */
+class ReadyBlocks {
+    RingQueue<BatchBlockPtr> queue;
+    const int32 event_fd;
+
+    // at most num_blocks consecutive sequence numbers are not queued yet, so a block waits at sequence_number % num_blocks
+    std::mutex order_mutex;
+    std::vector<BatchBlockPtr> out_of_order_blocks;
+    int64_t next_sequence_number{0};
+
+    std::mutex callback_mutex; // setting the callback waits for the running call to finish
+    std::function<void()> callback;
+
+public:
+    explicit ReadyBlocks(int32 num_blocks)
+            : queue(num_blocks),
+              event_fd(::eventfd(0, EFD_SEMAPHORE | EFD_NONBLOCK | EFD_CLOEXEC)),
+              out_of_order_blocks(num_blocks, nullptr) {
+        CHECK_SYSCALL(this->event_fd >= 0, "eventfd() failed");
+    }
+
+    ReadyBlocks(ReadyBlocks const &) = delete;
+
+    ReadyBlocks &operator=(ReadyBlocks const &) = delete;
+
+    ~ReadyBlocks() {
+        ::close(this->event_fd);
+    }
+
+    // must be called before the first push()
+    void start_at(int64_t sequence_number) {
+        std::lock_guard<std::mutex> lock(this->order_mutex);
+        this->next_sequence_number = sequence_number;
+    }
+
+    void push(BatchBlockPtr block) {
+        {
+            std::lock_guard<std::mutex> lock(this->order_mutex);
+            const int64_t num_blocks = static_cast<int64_t>(this->out_of_order_blocks.size());
+            ASSERT(block->sequence_number >= this->next_sequence_number && block->sequence_number < this->next_sequence_number + num_blocks,
+                   "%ld", block->sequence_number);
+            this->out_of_order_blocks[block->sequence_number % num_blocks] = block;
+
+            BatchBlockPtr next_block;
+            while ((next_block = this->out_of_order_blocks[this->next_sequence_number % num_blocks])) {
+                this->out_of_order_blocks[this->next_sequence_number % num_blocks] = nullptr;
+                ++this->next_sequence_number;
+
+                // the counter grows before the block is visible, so taking a block can always decrement it
+                const uint64_t one = 1;
+                CHECK_SYSCALL(::write(this->event_fd, &one, sizeof(one)) == sizeof(one), "write() to eventfd failed");
+                this->queue.push(next_block);
+            }
+            if (this->next_sequence_number <= block->sequence_number) {
+                return; // waits for blocks scheduled before it
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(this->callback_mutex);
+        if (this->callback) {
+            this->callback();
+        }
+    }
+
+    // sleeps until a batch may be available (it may be taken by another consumer first)
+    void wait() const {
+        pollfd poll_fd = {.fd = this->event_fd, .events = POLLIN, .revents = 0};
+        int result;
+        while ((result = ::poll(&poll_fd, 1, -1)) < 0 && errno == EINTR) {}
+        CHECK_SYSCALL(result == 1, "poll() on eventfd failed");
+    }
+
+    // the event of the block stays until retire()
+    bool try_pop(BatchBlockPtr &block) {
+        return this->queue.try_pop(block);
+    }
+
+    // called once for every popped block, when it cannot serve batches anymore
+    void retire() {
+        uint64_t value;
+        const ssize_t result = ::read(this->event_fd, &value, sizeof(value));
+        CHECK_SYSCALL(result == sizeof(value), "read() from eventfd failed");
+    }
+
+    int32 get_event_fd() const {
+        return this->event_fd;
+    }
+
+    void set_callback(std::function<void()> callback) {
+        std::lock_guard<std::mutex> lock(this->callback_mutex);
+        this->callback = std::move(callback);
+    }
+};
+
 
 struct BatchBlocks {
     typedef struct {
         std::function<byte *(size_t)> allocator;
         std::function<void(byte *)> deleter;
+        std::function<int64_t()> page_size = nullptr; // of allocated memory; nullptr: regular memory (may be advised to use THP)
     } Allocator;
 
-    static const int32_t NUM_BLOCKS = SamplingParametersCalculator::NUM_BATCH_BLOCKS;
     Allocator allocator;
+    const int64_t block_stride_b; // distance between consecutive blocks (keeps every block page-aligned)
+    const int64_t user_buffer_size_b;
     byte *user_buffer;
     std::vector<std::shared_ptr<BatchBlock>> batch_blocks;
-    BlockingQueue<BatchBlockPtr> ready_blocks;
+    ReadyBlocks ready_blocks;
 
-    BatchBlocks(int64_t element_size_b, int64_t num_samples, Allocator allocator)
+    BatchBlocks(int64_t element_size_b, int64_t num_samples, int32_t num_blocks, Allocator allocator)
             :
             allocator(allocator),
-            user_buffer(allocator.allocator((element_size_b * num_samples + PAGE_SIZE) * 2LL)),
-            batch_blocks{
-                    std::make_shared<BatchBlock>(element_size_b, num_samples, user_buffer),
-                    std::make_shared<BatchBlock>(element_size_b, num_samples, user_buffer + element_size_b * num_samples)
-            } {
-
-        ASSERT(batch_blocks.size() == NUM_BLOCKS, "%ld", batch_blocks.size());
+            block_stride_b(align_up(element_size_b * num_samples, PAGE_SIZE)),
+            user_buffer_size_b(block_stride_b * num_blocks + PAGE_SIZE),
+            user_buffer(allocator.allocator(user_buffer_size_b)),
+            ready_blocks(num_blocks) {
+
+        ASSERT(num_blocks >= 2, "%d", num_blocks);
+
+        // blocks form a ring: the consumer reads one of them while workers fill the others
+        for (int32_t block_idx = 0; block_idx < num_blocks; ++block_idx) {
+            this->batch_blocks.emplace_back(std::make_shared<BatchBlock>(
+                    block_idx, element_size_b, num_samples, align_up_ptr(user_buffer, PAGE_SIZE) + block_stride_b * block_idx
+            ));
+        }
     }
 
     BatchBlocks(BatchBlock const &other) = delete;
@@ -79,6 +207,18 @@ struct BatchBlocks {
     ~BatchBlocks() {
         allocator.deleter(user_buffer);
     }
+
+    Buffer get_memory() const {
+        return Buffer{.size = this->user_buffer_size_b, .buffer = this->user_buffer};
+    }
+
+    // block containing a batch returned by BatchBlock::claim_next_batch()
+    BatchBlockPtr get_block(byte const *batch) const {
+        const int64_t offset = batch - align_up_ptr(this->user_buffer, PAGE_SIZE);
+        const int64_t block_idx = offset >= 0 ? offset / this->block_stride_b : -1;
+        CASSERT(block_idx >= 0 && block_idx < static_cast<int64_t>(this->batch_blocks.size()), "%p is not a batch", batch);
+        return this->batch_blocks[block_idx].get();
+    }
 };
 
 
@@ -89,4 +229,17 @@ BatchBlocks::Allocator create_default_allocator() {
     };
 };
 
+// Maps batch blocks with HugeTLB pages (or transparent huge pages, see PageBuffer), which custom allocators cannot provide.
+inline BatchBlocks::Allocator create_page_allocator(HugePagesPolicyType huge_pages) {
+    auto memory = std::make_shared<PageBuffer>();
+    return {
+            .allocator = [memory, huge_pages](size_t size) {
+                *memory = PageBuffer(size, huge_pages, "batch blocks");
+                return memory->get();
+            },
+            .deleter = [memory](byte *) { *memory = PageBuffer(); },
+            .page_size = [memory]() { return memory->get_page_size(); }
+    };
+};
+
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstddef>
+#include <string>
+#include <vector>
 #include "utils.h"
 
 namespace nvme_sampler {
@@ -9,18 +11,96 @@ struct TensorDescription {
     const int64_t num_rows;
     const int64_t row_size_b; // in bytes
 
-    const std::string file_path;
+    const std::vector<std::string> file_paths; // dataset shards (rows of the first file go first)
 
     int64_t get_size() const {
         return num_rows * row_size_b;
     }
 };
 
+enum IoEngineType {
+    LibAioEngineType = 0,
+    IoUringEngineType = 1,
+    IoUringSqPollEngineType = 2 // io_uring with kernel-side submission polling
+};
+
+enum NumaPolicyType {
+    NoNumaPolicy = 0,
+    DeviceLocalNumaPolicy = 1 // workers and read buffers on the node of the drive, batch blocks on the node of the consumer
+};
+
+enum SamplingModeType {
+    WithReplacementSamplingMode = 0, // chunks are drawn independently
+    EpochSamplingMode = 1 // every epoch reads each chunk exactly once, in pseudo-random order
+};
+
+enum StorageFormatType {
+    RawStorageFormat = 0,
+    CompressedStorageFormat = 1 // containers of independently compressed chunks created by nvme_pack (see compression.h)
+};
+
+enum HugePagesPolicyType {
+    NoHugePages = 0,
+    TransparentHugePages = 1, // madvise(MADV_HUGEPAGE)
+    HugeTlb2MPages = 2, // hugetlbfs pool (vm.nr_hugepages), falls back to transparent huge pages
+    HugeTlb1GPages = 3
+};
+
+// order in which reads prepared together (a submission window) are sent to the device; rows land in the same places anyway
+enum SubmissionOrderType {
+    RandomSubmissionOrder = 0, // as drawn
+    OffsetSubmissionOrder = 1, // by file offset: the block layer can merge adjacent reads, devices see sequential-ish queues
+    StripeSubmissionOrder = 2 // by offset, interleaved over the members of a RAID-0 array (see SamplerConfig::stripe_size_b)
+};
+
+enum ValueFormatType {
+    Float32ValueFormat = 0,
+    Float16ValueFormat = 1, // IEEE 754 half precision
+    BFloat16ValueFormat = 2, // upper 16 bits of float32
+    Int8ValueFormat = 3 // value * scale + offset, with the scale and offset of its column (see SamplerConfig::int8_scales)
+};
+
+inline int64_t get_value_size_b(ValueFormatType value_format) {
+    switch (value_format) {
+        case Float32ValueFormat:
+            return 4;
+        case Float16ValueFormat:
+        case BFloat16ValueFormat:
+            return 2;
+        case Int8ValueFormat:
+            return 1;
+    }
+    ERROR("invalid value_format: " << value_format);
+}
+
+struct ByteRange {
+    int64_t offset;
+    int64_t length;
+};
+
 struct SamplerConfig {
     const int64_t max_batch_elements;
     const int64_t max_num_threads;
     const int64_t memory_usage_limit_b;
-    const int32_t seed = 123; // for ChunkSamplers
+    const int32_t seed = 123; // of random streams of workers
+    const IoEngineType io_engine = LibAioEngineType;
+    const int32_t io_queue_depth = 512; // number of reads each worker keeps in flight
+    const int32_t num_batch_blocks = 2; // memory_usage_limit_b is split between that many batch blocks
+    const bool zero_copy = true; // read rows directly into batch blocks if row size is a multiple of SECTOR_SIZE
+    const NumaPolicyType numa_policy = NoNumaPolicy;
+    const SamplingModeType sampling_mode = WithReplacementSamplingMode;
+    const std::string weights_path = ""; // optional file of WeightRange records (see alias_table.h); empty: uniform sampling
+    const std::vector<ByteRange> projection = {}; // parts of a row copied (packed, in this order) into batches; empty: whole rows
+    const StorageFormatType storage_format = RawStorageFormat;
+    const HugePagesPolicyType huge_pages = NoHugePages; // pages of read buffers and (see BatchBlocks::Allocator) batch blocks
+    const bool lock_memory = false; // mlock() read buffers and batch blocks
+    const ValueFormatType value_format = Float32ValueFormat; // of values in dataset files; batches always hold float32 values
+    const std::vector<float> int8_scales = {}; // int8 values: scale and offset of every column of a row; empty: 1 and 0
+    const std::vector<float> int8_offsets = {};
+    const SubmissionOrderType submission_order = RandomSubmissionOrder;
+    const int64_t stripe_size_b = 0; // StripeSubmissionOrder: chunk size of the RAID-0 array; 0: read from sysfs (md RAID-0)
+    const int32_t num_stripe_devices = 0; // StripeSubmissionOrder: members of the RAID-0 array; 0: read from sysfs
+    const bool auto_tune = false; // adjust queue depth and active workers while running (see AutoTuner), up to the values above
 };
 
 struct SamplingParameters {
@@ -29,20 +109,49 @@ struct SamplingParameters {
     const int64_t num_batches_in_block;
     const int64_t batch_size_b;
     const int64_t num_chunks;
+    const int64_t output_row_size_b; // size of a row in batches (differs from row size with a projection or a value_format)
 };
 
 namespace SamplingParametersCalculator {
 
-static const int64_t NUM_BATCH_BLOCKS = 2;
+static const int64_t MAX_NUM_BATCH_BLOCKS = 64;
 static const int64_t PAGE_SIZE = 4096; // os page size
 static const int64_t SECTOR_SIZE = 512; // os page size
 static const int64_t MAX_CHUNK_SIZE = PAGE_SIZE * 16; // 16384 float features
+static const int64_t MAX_IO_QUEUE_DEPTH = 4096;
+static const int64_t MAX_NUM_BATCHES_IN_BLOCK = 1L << 32; // rows of a block (columns are permuted by FeistelPermutation)
 
 static_assert(PAGE_SIZE % SECTOR_SIZE == 0, "Invalid PAGE_SIZE");
 static_assert(is_power_of_two(SECTOR_SIZE), "Invalid SECTOR_SIZE");
 static_assert(SECTOR_SIZE % 32 == 0, "Invalid SECTOR_SIZE (breaks AVX2 memcpy)");
 
-SamplingParameters calculate(int64_t file_size_b, int64_t element_size_b, SamplerConfig const &config) {
+// compressed chunks are always read whole, so only the number of batches in a block is chosen
+inline SamplingParameters calculate_compressed(int64_t file_size_b, int64_t element_size_b, int64_t chunk_rows, int64_t batch_size_b,
+                                        int64_t output_row_size_b, SamplerConfig const &config) {
+    const int64_t chunk_size_b = chunk_rows * element_size_b;
+    const int64_t max_num_batches_in_block = std::min(MAX_NUM_BATCHES_IN_BLOCK, config.memory_usage_limit_b / config.num_batch_blocks / batch_size_b);
+    for (int64_t num_batches_in_block = round_up_to_pow2(max_num_batches_in_block); num_batches_in_block >= 4; num_batches_in_block >>= 1) {
+        const int64_t used_memory_b = num_batches_in_block * batch_size_b * config.num_batch_blocks;
+        const int64_t num_chunks = (file_size_b + chunk_size_b - 1) / chunk_size_b;
+
+        if (used_memory_b < config.memory_usage_limit_b && num_batches_in_block >= chunk_rows) {
+            LOG_VARS("Sampling parameters (compressed)", chunk_size_b, chunk_rows, num_batches_in_block, num_chunks);
+            return SamplingParameters{
+                    .chunk_size_b = chunk_size_b,
+                    .max_chunk_size_b = chunk_size_b,
+                    .num_batches_in_block = num_batches_in_block,
+                    .batch_size_b = batch_size_b,
+                    .num_chunks = num_chunks,
+                    .output_row_size_b = output_row_size_b
+            };
+        }
+    }
+
+    ERROR("Cannot find decent sampling parameters for chunks of " << chunk_rows << " rows. Please increase memory_usage_limit_b");
+}
+
+// compressed_chunk_rows: rows in a chunk of compressed dataset files (0 for raw files)
+SamplingParameters calculate(int64_t file_size_b, int64_t element_size_b, SamplerConfig const &config, int64_t compressed_chunk_rows = 0) {
 
     CASSERT(file_size_b % element_size_b == 0, "Invalid input parameters. file_size_b: %ld; element_size_b: %ld", file_size_b, element_size_b);
     CASSERT(element_size_b >= 16, "element_size_b is too small: %ld", element_size_b)
@@ -50,22 +159,50 @@ SamplingParameters calculate(int64_t file_size_b, int64_t element_size_b, Sample
     CASSERT(config.max_num_threads <= 64, "max_num_threads is too small: %ld", config.max_num_threads)
     CASSERT(config.max_num_threads > 0, "max_num_threads is too big: %ld", config.max_num_threads)
     CASSERT(is_power_of_two(config.max_num_threads), "max_num_threads must be power of two: %ld", config.max_num_threads)
+    CASSERT(config.num_batch_blocks >= 2 && config.num_batch_blocks <= MAX_NUM_BATCH_BLOCKS, "invalid num_batch_blocks: %d", config.num_batch_blocks)
+    CASSERT(config.io_queue_depth > 0 && config.io_queue_depth <= MAX_IO_QUEUE_DEPTH, "invalid io_queue_depth: %d", config.io_queue_depth)
+    CASSERT(config.stripe_size_b >= 0 && config.num_stripe_devices >= 0 && (config.stripe_size_b > 0) == (config.num_stripe_devices > 0),
+            "stripe_size_b (%ld) and num_stripe_devices (%d) must be given together", config.stripe_size_b, config.num_stripe_devices)
     CASSERT(config.max_batch_elements % config.max_num_threads == 0,
             "max_batch_elements (%ld) must be divisible by max_num_threads (%ld)", config.max_batch_elements, config.max_num_threads)
 
-    const int64_t batch_size_b = element_size_b * config.max_batch_elements;
+    const int64_t value_size_b = get_value_size_b(config.value_format);
+    const int64_t num_columns = element_size_b / value_size_b;
+    CASSERT(element_size_b % value_size_b == 0, "element_size_b (%ld) must be a multiple of the value size (%ld)", element_size_b, value_size_b);
+    CASSERT(config.int8_scales.size() == config.int8_offsets.size(), "int8_scales and int8_offsets differ in size: %ld != %ld",
+            static_cast<int64_t>(config.int8_scales.size()), static_cast<int64_t>(config.int8_offsets.size()));
+    CASSERT(config.int8_scales.empty() || (config.value_format == Int8ValueFormat && static_cast<int64_t>(config.int8_scales.size()) == num_columns),
+            "int8_scales and int8_offsets need int8 values and one entry per column (%ld), got %ld", num_columns,
+            static_cast<int64_t>(config.int8_scales.size()));
+
+    // values are converted to float32, so batches hold sizeof(float) / value_size_b times more bytes than were read
+    int64_t output_row_size_b = config.projection.empty() ? num_columns * 4 : 0;
+    for (auto const &range : config.projection) {
+        CASSERT(range.offset >= 0 && range.length > 0 && range.offset + range.length <= element_size_b,
+                "invalid projection range: offset: %ld, length: %ld", range.offset, range.length);
+        CASSERT(range.offset % value_size_b == 0 && range.length % value_size_b == 0,
+                "projection range splits values: offset: %ld, length: %ld", range.offset, range.length);
+        output_row_size_b += range.length / value_size_b * 4;
+    }
 
-    CASSERT(batch_size_b <= file_size_b, "max_batch_elements (%ld) is too large for this file", config.max_batch_elements);
-    CASSERT(batch_size_b * NUM_BATCH_BLOCKS <= config.memory_usage_limit_b,
+    const int64_t batch_size_b = output_row_size_b * config.max_batch_elements;
+
+    CASSERT(element_size_b * config.max_batch_elements <= file_size_b, "max_batch_elements (%ld) is too large for this file",
+            config.max_batch_elements);
+    CASSERT(batch_size_b * config.num_batch_blocks <= config.memory_usage_limit_b,
             "max_batch_elements (%ld) is too large for this memory_usage_limit_b (%ld)", config.max_batch_elements, config.memory_usage_limit_b);
 
+    if (compressed_chunk_rows > 0) {
+        return calculate_compressed(file_size_b, element_size_b, compressed_chunk_rows, batch_size_b, output_row_size_b, config);
+    }
+
     // maximize num_batches_in_block, so that:
     // - memory_usage_limit_b is not exceeded
     // - wasted_reads_ratio < 5%
-    const int64_t max_num_batches_in_block = std::min(1L << 15, config.memory_usage_limit_b / NUM_BATCH_BLOCKS / batch_size_b);
+    const int64_t max_num_batches_in_block = std::min(MAX_NUM_BATCHES_IN_BLOCK, config.memory_usage_limit_b / config.num_batch_blocks / batch_size_b);
     for (int64_t num_batches_in_block = round_up_to_pow2(max_num_batches_in_block); num_batches_in_block >= 4; num_batches_in_block >>= 1) {
         for (int64_t chunk_size_b = PAGE_SIZE; chunk_size_b <= MAX_CHUNK_SIZE; chunk_size_b += PAGE_SIZE) {
-            const int64_t used_memory_b = num_batches_in_block * batch_size_b * NUM_BATCH_BLOCKS;
+            const int64_t used_memory_b = num_batches_in_block * batch_size_b * config.num_batch_blocks;
             const int64_t reminder_b = (chunk_size_b % element_size_b == 0) ? 0 : element_size_b - (chunk_size_b % element_size_b);
             const int64_t additional_read_size_b = reminder_b == 0 ? 0 : align_up(reminder_b, SECTOR_SIZE);
             const int64_t total_read_size_b = additional_read_size_b + chunk_size_b;
@@ -89,7 +226,8 @@ SamplingParameters calculate(int64_t file_size_b, int64_t element_size_b, Sample
                         .max_chunk_size_b = max_chunk_size_b,
                         .num_batches_in_block = num_batches_in_block,
                         .batch_size_b = batch_size_b,
-                        .num_chunks = num_chunks
+                        .num_chunks = num_chunks,
+                        .output_row_size_b = output_row_size_b
                 };
             }
         }
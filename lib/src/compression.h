@@ -0,0 +1,180 @@
+#pragma once
+
+#include "utils.h"
+#include "buffers.h"
+#include "calculator.h"
+#include "mapped_file.h"
+
+#include <lz4.h>
+#include <zstd.h>
+#include <algorithm>
+#include <string>
+
+namespace nvme_sampler {
+
+enum CompressionCodecType {
+    Lz4CompressionCodec = 1,
+    ZstdCompressionCodec = 2
+};
+
+/**
+ * Header of a compressed container (see CompressedContainer), stored in its first page.
+ */
+struct ContainerHeader {
+    uint64 magic;
+    int64 version;
+    int64 codec; // CompressionCodecType
+    int64 row_size_b;
+    int64 num_rows;
+    int64 chunk_rows; // rows in every chunk but the last one
+    int64 num_chunks;
+    int64 max_read_size_b; // largest sector-aligned read of a single chunk
+    int64 index_offset; // page-aligned offset of num_chunks ChunkIndexEntry records
+};
+
+struct ChunkIndexEntry {
+    int64 offset; // sector-aligned
+    int64 compressed_size_b;
+};
+
+static_assert(sizeof(ChunkIndexEntry) == 16, "ChunkIndexEntry must match the file format");
+
+/**
+ * Dataset file split into chunks of chunk_rows rows compressed independently (created by nvme_pack).
+ *
+ * Every chunk starts at a sector-aligned offset, so it is fetched with a single O_DIRECT read and workers decompress it
+ * before scattering its rows. Layout: header page, compressed chunks, index of chunk offsets (memory-mapped).
+ */
+class CompressedContainer {
+public:
+    static const uint64 MAGIC = 0x31504d43454d564eULL; // "NVMECMP1"
+    static const int64 VERSION = 1;
+    static const int64 DATA_OFFSET = SamplingParametersCalculator::PAGE_SIZE; // compressed chunks follow the header page
+
+private:
+    ContainerHeader header;
+    MappedFile index_mapping;
+    ChunkIndexEntry const *index{nullptr};
+
+public:
+    explicit CompressedContainer(std::string const &path) : header(read_header(path)) {
+        const int64 index_size_b = this->header.num_chunks * static_cast<int64>(sizeof(ChunkIndexEntry));
+        const bool opened = this->index_mapping.open(path, this->header.index_offset, index_size_b);
+        CASSERT(opened, "file %s does not exist", path.c_str());
+        this->index = this->index_mapping.data<ChunkIndexEntry>();
+    }
+
+    CompressedContainer(CompressedContainer const &) = delete;
+
+    CompressedContainer &operator=(CompressedContainer const &) = delete;
+
+    // validates the header without mapping the index
+    static ContainerHeader read_header(std::string const &path) {
+        MappedFile mapping;
+        const bool opened = mapping.open(path, 0, sizeof(ContainerHeader));
+        CASSERT(opened, "file %s does not exist", path.c_str());
+        ContainerHeader header = *mapping.data<ContainerHeader>();
+
+        CASSERT(header.magic == MAGIC, "%s is not a compressed container", path.c_str());
+        CASSERT(header.version == VERSION, "unsupported version of compressed container %s: %ld", path.c_str(), header.version);
+        CASSERT(header.codec == Lz4CompressionCodec || header.codec == ZstdCompressionCodec, "unknown codec of %s: %ld",
+                path.c_str(), header.codec);
+        CASSERT(header.chunk_rows > 0 && header.num_chunks == (header.num_rows + header.chunk_rows - 1) / header.chunk_rows,
+                "invalid chunk layout of %s", path.c_str());
+        CASSERT(header.index_offset % SamplingParametersCalculator::PAGE_SIZE == 0 && header.max_read_size_b > 0 &&
+                header.max_read_size_b % SamplingParametersCalculator::SECTOR_SIZE == 0,
+                "corrupted header of %s", path.c_str());
+        return header;
+    }
+
+    ContainerHeader const &get_header() const {
+        return this->header;
+    }
+
+    inline ChunkIndexEntry const &get_chunk(int64 chunk_idx) const {
+        return this->index[chunk_idx];
+    }
+
+    inline int64 get_num_chunk_rows(int64 chunk_idx) const {
+        return std::min(this->header.chunk_rows, this->header.num_rows - chunk_idx * this->header.chunk_rows);
+    }
+};
+
+/**
+ * Per-thread decompression state (zstd contexts are reused between chunks).
+ */
+class Decompressor {
+    const CompressionCodecType codec;
+    ZSTD_DCtx *zstd_context{nullptr};
+
+public:
+    explicit Decompressor(CompressionCodecType codec) : codec(codec) {
+        if (codec == ZstdCompressionCodec) {
+            this->zstd_context = ::ZSTD_createDCtx();
+            CASSERT(this->zstd_context != nullptr, "ZSTD_createDCtx() failed");
+        }
+    }
+
+    Decompressor(Decompressor const &) = delete;
+
+    Decompressor &operator=(Decompressor const &) = delete;
+
+    ~Decompressor() {
+        if (this->zstd_context) {
+            ::ZSTD_freeDCtx(this->zstd_context);
+        }
+    }
+
+    // returns the decompressed size or -1 if data is corrupted
+    int64 decompress(byte const *src, int64 src_size_b, byte *dst, int64 dst_capacity_b) {
+        if (this->codec == Lz4CompressionCodec) {
+            return ::LZ4_decompress_safe(reinterpret_cast<char const *>(src), reinterpret_cast<char *>(dst),
+                                         static_cast<int>(src_size_b), static_cast<int>(dst_capacity_b));
+        }
+        const size_t result = ::ZSTD_decompressDCtx(this->zstd_context, dst, dst_capacity_b, src, src_size_b);
+        return ::ZSTD_isError(result) ? -1 : static_cast<int64>(result);
+    }
+};
+
+namespace Compression {
+
+inline int64 get_compress_bound(CompressionCodecType codec, int64 size_b) {
+    if (codec == Lz4CompressionCodec) {
+        return ::LZ4_compressBound(static_cast<int>(size_b));
+    }
+    return static_cast<int64>(::ZSTD_compressBound(size_b));
+}
+
+// returns the compressed size; dst must hold get_compress_bound(codec, src_size_b) bytes
+inline int64 compress(CompressionCodecType codec, int32 level, byte const *src, int64 src_size_b, byte *dst, int64 dst_capacity_b) {
+    if (codec == Lz4CompressionCodec) {
+        const int result = ::LZ4_compress_fast(reinterpret_cast<char const *>(src), reinterpret_cast<char *>(dst),
+                                               static_cast<int>(src_size_b), static_cast<int>(dst_capacity_b), std::max(level, 1));
+        CASSERT(result > 0, "LZ4_compress_fast() failed: %d", result);
+        return result;
+    }
+    const size_t result = ::ZSTD_compress(dst, dst_capacity_b, src, src_size_b, level);
+    CASSERT(!::ZSTD_isError(result), "ZSTD_compress() failed: %s", ::ZSTD_getErrorName(result));
+    return static_cast<int64>(result);
+}
+
+// rows in a chunk of compressed dataset files (0 if files are not compressed); all shards must use the same chunk_rows
+inline int64 get_chunk_rows(TensorDescription const &tensor_description, SamplerConfig const &config) {
+    if (config.storage_format != CompressedStorageFormat) {
+        return 0;
+    }
+
+    int64 chunk_rows = 0;
+    for (auto const &file_path : tensor_description.file_paths) {
+        const ContainerHeader header = CompressedContainer::read_header(file_path);
+        CASSERT(header.row_size_b == tensor_description.row_size_b, "row size of %s is %ld, expected %ld",
+                file_path.c_str(), header.row_size_b, tensor_description.row_size_b);
+        CASSERT(chunk_rows == 0 || chunk_rows == header.chunk_rows, "shards must have chunks of the same number of rows");
+        chunk_rows = header.chunk_rows;
+    }
+    return chunk_rows;
+}
+
+}
+
+}
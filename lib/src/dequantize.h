@@ -0,0 +1,186 @@
+#pragma once
+
+#include "utils.h"
+#include "buffers.h"
+#include "calculator.h"
+
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+namespace nvme_sampler {
+
+/**
+ * Kernels widening values of reduced-precision dataset files (see ValueFormatType) into float32 batches; workers run them
+ * instead of a copy while scattering rows of a read, when the rows are still in cache. Like copy kernels (memcpy.h) they
+ * are picked at runtime by the features of the CPU. All kernels of a format give bit-identical results (int8 values are
+ * converted with a fused multiply-add also by the scalar kernel).
+ */
+namespace Dequantize {
+
+// scales and offsets: of the converted columns (int8 values only)
+typedef void (*ConvertFunction)(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                float const *offsets);
+
+struct ConvertKernel {
+    char const *name;
+    ValueFormatType value_format;
+    ConvertFunction convert;
+    bool (*is_supported)();
+};
+
+inline float half_to_float(uint16_t half) {
+    const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+    const uint32_t exponent = (half >> 10) & 0x1f;
+    const uint32_t mantissa = half & 0x3ff;
+
+    uint32_t bits;
+    if (exponent == 0x1f) { // infinity or NaN (quieted, like by F16C)
+        bits = sign | 0x7f800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    } else { // zero or subnormal: mantissa * 2^-24 is exact in float32
+        const float value = static_cast<float>(mantissa) * (1.0f / (1 << 24));
+        std::memcpy(&bits, &value, sizeof(bits));
+        bits |= sign;
+    }
+
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline float bfloat16_to_float(uint16_t value) {
+    const uint32_t bits = static_cast<uint32_t>(value) << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline void scalar_float16_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *, float const *) {
+    for (int64 idx = 0; idx < num_values; ++idx) {
+        uint16_t value;
+        std::memcpy(&value, src + idx * sizeof(value), sizeof(value));
+        dst[idx] = half_to_float(value);
+    }
+}
+
+inline void scalar_bfloat16_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *, float const *) {
+    for (int64 idx = 0; idx < num_values; ++idx) {
+        uint16_t value;
+        std::memcpy(&value, src + idx * sizeof(value), sizeof(value));
+        dst[idx] = bfloat16_to_float(value);
+    }
+}
+
+inline void scalar_int8_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                 float const *offsets) {
+    for (int64 idx = 0; idx < num_values; ++idx) {
+        dst[idx] = std::fma(static_cast<float>(static_cast<int8_t>(src[idx])), scales[idx], offsets[idx]);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void avx512_float16_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                    float const *offsets) {
+    int64 idx = 0;
+    for (; idx + 16 <= num_values; idx += 16) {
+        const __m256i values = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + idx * 2));
+        _mm512_storeu_ps(dst + idx, _mm512_cvtph_ps(values));
+    }
+    scalar_float16_to_float(dst + idx, src + idx * 2, num_values - idx, scales, offsets);
+}
+
+__attribute__((target("avx,f16c")))
+inline void f16c_float16_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                  float const *offsets) {
+    int64 idx = 0;
+    for (; idx + 8 <= num_values; idx += 8) {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + idx * 2));
+        _mm256_storeu_ps(dst + idx, _mm256_cvtph_ps(values));
+    }
+    scalar_float16_to_float(dst + idx, src + idx * 2, num_values - idx, scales, offsets);
+}
+
+__attribute__((target("avx512f")))
+inline void avx512_bfloat16_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                     float const *offsets) {
+    int64 idx = 0;
+    for (; idx + 16 <= num_values; idx += 16) {
+        const __m256i values = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + idx * 2));
+        _mm512_storeu_ps(dst + idx, _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_cvtepu16_epi32(values), 16)));
+    }
+    scalar_bfloat16_to_float(dst + idx, src + idx * 2, num_values - idx, scales, offsets);
+}
+
+__attribute__((target("avx2")))
+inline void avx2_bfloat16_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                   float const *offsets) {
+    int64 idx = 0;
+    for (; idx + 8 <= num_values; idx += 8) {
+        const __m128i values = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + idx * 2));
+        _mm256_storeu_ps(dst + idx, _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(values), 16)));
+    }
+    scalar_bfloat16_to_float(dst + idx, src + idx * 2, num_values - idx, scales, offsets);
+}
+
+__attribute__((target("avx512f")))
+inline void avx512_int8_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                                 float const *offsets) {
+    int64 idx = 0;
+    for (; idx + 16 <= num_values; idx += 16) {
+        const __m512 values = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const *>(src + idx))));
+        _mm512_storeu_ps(dst + idx, _mm512_fmadd_ps(values, _mm512_loadu_ps(scales + idx), _mm512_loadu_ps(offsets + idx)));
+    }
+    scalar_int8_to_float(dst + idx, src + idx, num_values - idx, scales + idx, offsets + idx);
+}
+
+__attribute__((target("avx2,fma")))
+inline void avx2_int8_to_float(float *__restrict dst, byte const *__restrict src, int64 num_values, float const *scales,
+                               float const *offsets) {
+    int64 idx = 0;
+    for (; idx + 8 <= num_values; idx += 8) {
+        const __m256 values = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64(reinterpret_cast<__m128i const *>(src + idx))));
+        _mm256_storeu_ps(dst + idx, _mm256_fmadd_ps(values, _mm256_loadu_ps(scales + idx), _mm256_loadu_ps(offsets + idx)));
+    }
+    scalar_int8_to_float(dst + idx, src + idx, num_values - idx, scales + idx, offsets + idx);
+}
+
+// best first (for every format)
+static const ConvertKernel KERNELS[] = {
+        {.name = "avx512_float16", .value_format = Float16ValueFormat, .convert = avx512_float16_to_float,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx512f") != 0; }},
+        {.name = "f16c_float16", .value_format = Float16ValueFormat, .convert = f16c_float16_to_float,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c"); }},
+        {.name = "scalar_float16", .value_format = Float16ValueFormat, .convert = scalar_float16_to_float,
+                .is_supported = []() { return true; }},
+        {.name = "avx512_bfloat16", .value_format = BFloat16ValueFormat, .convert = avx512_bfloat16_to_float,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx512f") != 0; }},
+        {.name = "avx2_bfloat16", .value_format = BFloat16ValueFormat, .convert = avx2_bfloat16_to_float,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; }},
+        {.name = "scalar_bfloat16", .value_format = BFloat16ValueFormat, .convert = scalar_bfloat16_to_float,
+                .is_supported = []() { return true; }},
+        {.name = "avx512_int8", .value_format = Int8ValueFormat, .convert = avx512_int8_to_float,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx512f") != 0; }},
+        {.name = "avx2_int8", .value_format = Int8ValueFormat, .convert = avx2_int8_to_float,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"); }},
+        {.name = "scalar_int8", .value_format = Int8ValueFormat, .convert = scalar_int8_to_float,
+                .is_supported = []() { return true; }}
+};
+
+// the best kernel supported by the CPU for values of value_format; nullptr for float32 values (they are copied)
+inline ConvertKernel const *select_kernel(ValueFormatType value_format) {
+    if (value_format == Float32ValueFormat) {
+        return nullptr;
+    }
+    for (auto const &kernel : KERNELS) {
+        if (kernel.value_format == value_format && kernel.is_supported()) {
+            return &kernel;
+        }
+    }
+    ERROR("no conversion kernel for value_format: " << value_format);
+}
+
+}
+
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+#include "utils.h"
+#include "buffers.h"
+#include "calculator.h"
+
+#include <libaio.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <ctime>
+
+namespace nvme_sampler {
+
+// longest wait() of an engine, so that workers notice a closed work queue even if reads hang
+static const int64 IO_WAIT_TIMEOUT_NS = 100 * 1000 * 1000;
+
+struct IoCompletion {
+    void *data;
+    int64 result; // number of bytes read or -errno
+};
+
+/**
+ * Asynchronous read interface used by WorkerThread.
+ *
+ * Reads are prepared one by one and sent to the kernel with a single submit() call. Buffers passed to prep_read() must lie
+ * inside the read buffer given to create_io_engine() (io_uring registers it once instead of pinning pages on every read).
+ */
+class IoEngine {
+public:
+    virtual ~IoEngine() {}
+
+    // slot identifies the request until its completion is returned by wait(); it must be lower than queue_depth
+    virtual void prep_read(int32 slot, byte *buffer, int64 size, int64 offset, void *data) = 0;
+
+    // vectored read; iovecs may point anywhere (they are not covered by the registered buffer) and must stay valid until completion
+    virtual void prep_readv(int32 slot, iovec const *iovecs, int32 num_iovecs, int64 offset, void *data) = 0;
+
+    // submits all reads prepared since the last call
+    virtual void submit() = 0;
+
+    // waits for at least min_completions finished reads; returns number of completions stored in the output array
+    virtual int32 wait(int32 min_completions, int32 max_completions, IoCompletion *completions) = 0;
+};
+
+class LibAioEngine : public IoEngine {
+    const int32 file_descriptor;
+    const int32 queue_depth;
+
+    io_context_t io_ctx{nullptr};
+    scoped_array<iocb> io_requests;
+    scoped_array<iocb *> pending_requests;
+    scoped_array<io_event> io_events;
+    int32 num_prepared{0};
+
+public:
+    LibAioEngine(int32 file_descriptor, int32 queue_depth)
+            : file_descriptor(file_descriptor),
+              queue_depth(queue_depth),
+              io_requests(new iocb[queue_depth]),
+              pending_requests(new iocb *[queue_depth]),
+              io_events(new io_event[queue_depth]) {
+        CHECK_SYSCALL(::io_setup(queue_depth, &io_ctx) == 0, "Failed to setup aio context");
+    }
+
+    ~LibAioEngine() {
+        CHECK_SYSCALL(::io_destroy(this->io_ctx) == 0, "Failed to destroy aio context");
+    }
+
+    void prep_read(int32 slot, byte *buffer, int64 size, int64 offset, void *data) override {
+        DASSERT(slot >= 0 && slot < queue_depth && num_prepared < queue_depth, "slot: %d; num_prepared: %d", slot, num_prepared);
+
+        iocb *request = &this->io_requests[slot];
+
+        ::io_prep_pread(request, this->file_descriptor, buffer, static_cast<size_t>(size), offset);
+        request->data = data;
+        this->pending_requests[this->num_prepared++] = request;
+    }
+
+    void prep_readv(int32 slot, iovec const *iovecs, int32 num_iovecs, int64 offset, void *data) override {
+        DASSERT(slot >= 0 && slot < queue_depth && num_prepared < queue_depth, "slot: %d; num_prepared: %d", slot, num_prepared);
+
+        iocb *request = &this->io_requests[slot];
+
+        ::io_prep_preadv(request, this->file_descriptor, iovecs, num_iovecs, offset);
+        request->data = data;
+        this->pending_requests[this->num_prepared++] = request;
+    }
+
+    void submit() override {
+        if (this->num_prepared == 0) {
+            return;
+        }
+
+        if (::io_submit(this->io_ctx, this->num_prepared, this->pending_requests.get()) != this->num_prepared) {
+            ERROR("io_submit() failed");
+        }
+        this->num_prepared = 0;
+    }
+
+    int32 wait(int32 min_completions, int32 max_completions, IoCompletion *completions) override {
+        max_completions = std::min(max_completions, this->queue_depth);
+
+        timespec timeout{.tv_sec = 0, .tv_nsec = IO_WAIT_TIMEOUT_NS};
+        int32 num_events = ::io_getevents(this->io_ctx, min_completions, max_completions, this->io_events.get(), &timeout);
+        CHECK_SYSCALL(num_events >= 0, "io_getevents() failed: num_events: " << num_events);
+
+        for (int32 event_idx = 0; event_idx < num_events; ++event_idx) {
+            completions[event_idx] = IoCompletion{
+                    .data = this->io_events[event_idx].data,
+                    .result = static_cast<int64>(this->io_events[event_idx].res)
+            };
+        }
+
+        return num_events;
+    }
+};
+
+/**
+ * io_uring engine talking to the kernel directly (no liburing dependency).
+ *
+ * The read buffer and the file descriptor are registered once, so reads are issued as IORING_OP_READ_FIXED on a fixed file
+ * and the kernel neither re-pins pages nor looks up the file on every request. With SQPOLL a kernel thread consumes the
+ * submission ring and submit() needs a syscall only when that thread went idle. wait() passes a timeout with
+ * IORING_ENTER_EXT_ARG (Linux 5.11); kernels without it, or without one of the read opcodes (probed at setup, they may
+ * also be disabled), use libaio (see is_supported()).
+ */
+class IoUringEngine : public IoEngine {
+    static const uint32_t SQ_THREAD_IDLE_MS = 50;
+    static const int32 MAX_PROBED_OPS = 256;
+
+    const int32 queue_depth;
+    const bool sq_poll;
+
+    int32 ring_fd{-1};
+    bool registered_buffer{false};
+
+    void *sq_ring{nullptr};
+    void *cq_ring{nullptr};
+    size_t sq_ring_size{0};
+    size_t cq_ring_size{0};
+    io_uring_sqe *sqes{nullptr};
+    size_t sqes_size{0};
+
+    uint32_t *sq_head;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_flags;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    io_uring_cqe *cqes;
+
+    uint32_t local_sq_tail{0};
+    int32 num_prepared{0};
+
+public:
+    IoUringEngine(int32 ring_fd, io_uring_params const &params, bool sq_poll, int32 file_descriptor, Buffer const &read_buffer)
+            : queue_depth(params.sq_entries), sq_poll(sq_poll), ring_fd(ring_fd) {
+        this->map_rings(params);
+
+        CHECK_SYSCALL(::syscall(__NR_io_uring_register, this->ring_fd, IORING_REGISTER_FILES, &file_descriptor, 1) == 0,
+                      "Failed to register file in io_uring");
+
+        if (read_buffer.size > 0) {
+            iovec buffer_iov{.iov_base = read_buffer.buffer, .iov_len = static_cast<size_t>(read_buffer.size)};
+            this->registered_buffer = ::syscall(__NR_io_uring_register, this->ring_fd, IORING_REGISTER_BUFFERS, &buffer_iov, 1) == 0;
+            if (!this->registered_buffer) {
+                LOG("io_uring buffer registration failed (errno: " << errno << "; check RLIMIT_MEMLOCK), using unregistered reads");
+            }
+        }
+    }
+
+    ~IoUringEngine() {
+        ::munmap(this->sqes, this->sqes_size);
+        if (this->cq_ring != this->sq_ring) {
+            ::munmap(this->cq_ring, this->cq_ring_size);
+        }
+        ::munmap(this->sq_ring, this->sq_ring_size);
+        CHECK_SYSCALL(::close(this->ring_fd) == 0, "Failed to close io_uring");
+    }
+
+    // returns -1 (and sets errno) if the kernel does not support io_uring or SQPOLL is not permitted
+    static int32 setup(int32 queue_depth, bool sq_poll, io_uring_params &params) {
+        ::memset(&params, 0, sizeof(params));
+        if (sq_poll) {
+            params.flags |= IORING_SETUP_SQPOLL;
+            params.sq_thread_idle = SQ_THREAD_IDLE_MS;
+        }
+
+        return static_cast<int32>(::syscall(__NR_io_uring_setup, queue_depth, &params));
+    }
+
+    // whether the kernel of a ring set up by setup() supports everything the engine uses
+    static bool is_supported(int32 ring_fd, io_uring_params const &params) {
+        if (!(params.features & IORING_FEAT_EXT_ARG)) {
+            LOG("io_uring does not support timed waits (IORING_FEAT_EXT_ARG, Linux 5.11)");
+            return false;
+        }
+
+        scoped_array<byte> probe_buffer(new byte[sizeof(io_uring_probe) + MAX_PROBED_OPS * sizeof(io_uring_probe_op)]());
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(probe_buffer.get());
+        if (::syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PROBE, probe, MAX_PROBED_OPS) != 0) {
+            LOG("io_uring opcode probe failed (errno: " << errno << ")");
+            return false;
+        }
+        for (uint8_t opcode : {IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_READV}) {
+            if (opcode > probe->last_op || !(probe->ops[opcode].flags & IO_URING_OP_SUPPORTED)) {
+                LOG("io_uring does not support opcode " << static_cast<int32>(opcode));
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void prep_read(int32 slot, byte *buffer, int64 size, int64 offset, void *data) override {
+        DASSERT(slot >= 0 && num_prepared < queue_depth, "slot: %d; num_prepared: %d", slot, num_prepared);
+
+        io_uring_sqe *sqe = this->next_sqe();
+        sqe->opcode = this->registered_buffer ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = 0; // index of the registered file
+        sqe->addr = reinterpret_cast<uint64>(buffer);
+        sqe->len = static_cast<uint32_t>(size);
+        sqe->off = static_cast<uint64>(offset);
+        sqe->buf_index = 0;
+        sqe->user_data = reinterpret_cast<uint64>(data);
+    }
+
+    void prep_readv(int32 slot, iovec const *iovecs, int32 num_iovecs, int64 offset, void *data) override {
+        DASSERT(slot >= 0 && num_prepared < queue_depth, "slot: %d; num_prepared: %d", slot, num_prepared);
+
+        io_uring_sqe *sqe = this->next_sqe();
+        sqe->opcode = IORING_OP_READV;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = 0;
+        sqe->addr = reinterpret_cast<uint64>(iovecs);
+        sqe->len = static_cast<uint32_t>(num_iovecs);
+        sqe->off = static_cast<uint64>(offset);
+        sqe->user_data = reinterpret_cast<uint64>(data);
+    }
+
+    void submit() override {
+        if (this->num_prepared == 0) {
+            return;
+        }
+
+        __atomic_store_n(this->sq_tail, this->local_sq_tail, __ATOMIC_RELEASE);
+
+        if (this->sq_poll) {
+            // full barrier: the kernel thread must see the new tail before we check whether it sleeps
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (__atomic_load_n(this->sq_flags, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+                this->enter(0, 0, IORING_ENTER_SQ_WAKEUP);
+            }
+        } else {
+            int32 num_submitted = this->enter(this->num_prepared, 0, 0);
+            ERROR_ON(num_submitted != this->num_prepared, "io_uring_enter() submitted %d of %d reads", num_submitted, this->num_prepared);
+        }
+        this->num_prepared = 0;
+    }
+
+    int32 wait(int32 min_completions, int32 max_completions, IoCompletion *completions) override {
+        uint32_t head = *this->cq_head;
+        uint32_t available = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE) - head;
+
+        if (available < static_cast<uint32_t>(min_completions)) {
+            __kernel_timespec timeout{.tv_sec = 0, .tv_nsec = IO_WAIT_TIMEOUT_NS};
+            io_uring_getevents_arg arg{.sigmask = 0, .sigmask_sz = _NSIG / 8, .pad = 0, .ts = reinterpret_cast<uint64>(&timeout)};
+            this->enter(0, min_completions - available, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+            available = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE) - head;
+        }
+
+        const int32 num_completions = std::min(static_cast<int32>(available), max_completions);
+        for (int32 idx = 0; idx < num_completions; ++idx) {
+            io_uring_cqe const &cqe = this->cqes[(head + idx) & *this->cq_mask];
+            completions[idx] = IoCompletion{
+                    .data = reinterpret_cast<void *>(cqe.user_data),
+                    .result = cqe.res
+            };
+        }
+        __atomic_store_n(this->cq_head, head + num_completions, __ATOMIC_RELEASE);
+
+        return num_completions;
+    }
+
+private:
+    io_uring_sqe *next_sqe() {
+        const uint32_t index = this->local_sq_tail & *this->sq_mask;
+        io_uring_sqe *sqe = &this->sqes[index];
+        ::memset(sqe, 0, sizeof(*sqe));
+
+        this->sq_array[index] = index;
+        this->local_sq_tail++;
+        this->num_prepared++;
+        return sqe;
+    }
+
+    // returns 0 if a wait timed out
+    int32 enter(uint32_t to_submit, uint32_t min_complete, uint32_t flags, void const *arg = nullptr, size_t arg_size = 0) {
+        for (;;) {
+            long ret = ::syscall(__NR_io_uring_enter, this->ring_fd, to_submit, min_complete, flags, arg, arg_size);
+            if (ret >= 0) {
+                return static_cast<int32>(ret);
+            }
+            if (errno == ETIME) {
+                return 0;
+            }
+            CHECK_SYSCALL(errno == EINTR || errno == EAGAIN, "io_uring_enter() failed");
+        }
+    }
+
+    void map_rings(io_uring_params const &params) {
+        this->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        this->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+        const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single_mmap) {
+            this->sq_ring_size = this->cq_ring_size = std::max(this->sq_ring_size, this->cq_ring_size);
+        }
+
+        this->sq_ring = ::mmap(nullptr, this->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQ_RING);
+        CHECK_SYSCALL(this->sq_ring != MAP_FAILED, "Failed to map io_uring submission ring");
+
+        if (single_mmap) {
+            this->cq_ring = this->sq_ring;
+        } else {
+            this->cq_ring = ::mmap(nullptr, this->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_CQ_RING);
+            CHECK_SYSCALL(this->cq_ring != MAP_FAILED, "Failed to map io_uring completion ring");
+        }
+
+        this->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        this->sqes = static_cast<io_uring_sqe *>(
+                ::mmap(nullptr, this->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring_fd, IORING_OFF_SQES));
+        CHECK_SYSCALL(this->sqes != MAP_FAILED, "Failed to map io_uring submission entries");
+
+        byte *sq = static_cast<byte *>(this->sq_ring);
+        byte *cq = static_cast<byte *>(this->cq_ring);
+        this->sq_head = reinterpret_cast<uint32_t *>(sq + params.sq_off.head);
+        this->sq_tail = reinterpret_cast<uint32_t *>(sq + params.sq_off.tail);
+        this->sq_mask = reinterpret_cast<uint32_t *>(sq + params.sq_off.ring_mask);
+        this->sq_flags = reinterpret_cast<uint32_t *>(sq + params.sq_off.flags);
+        this->sq_array = reinterpret_cast<uint32_t *>(sq + params.sq_off.array);
+        this->cq_head = reinterpret_cast<uint32_t *>(cq + params.cq_off.head);
+        this->cq_tail = reinterpret_cast<uint32_t *>(cq + params.cq_off.tail);
+        this->cq_mask = reinterpret_cast<uint32_t *>(cq + params.cq_off.ring_mask);
+        this->cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+        this->local_sq_tail = *this->sq_tail;
+    }
+};
+
+/**
+ * Creates the requested engine. Falls back to libaio if io_uring is not available (old kernel, seccomp, missing
+ * privileges for SQPOLL) or lacks a feature the engine uses.
+ */
+inline std::unique_ptr<IoEngine> create_io_engine(IoEngineType type, int32 file_descriptor, int32 queue_depth, Buffer const &read_buffer) {
+    if (type == IoUringEngineType || type == IoUringSqPollEngineType) {
+        const bool sq_poll = type == IoUringSqPollEngineType;
+        io_uring_params params;
+        int32 ring_fd = IoUringEngine::setup(queue_depth, sq_poll, params);
+
+        if (ring_fd >= 0 && IoUringEngine::is_supported(ring_fd, params)) {
+            return std::unique_ptr<IoEngine>(new IoUringEngine(ring_fd, params, sq_poll, file_descriptor, read_buffer));
+        }
+        if (ring_fd >= 0) {
+            CHECK_SYSCALL(::close(ring_fd) == 0, "Failed to close io_uring");
+            LOG("io_uring lacks required features, falling back to libaio");
+        } else {
+            LOG("io_uring_setup() failed (errno: " << errno << "), falling back to libaio");
+        }
+    }
+
+    return std::unique_ptr<IoEngine>(new LibAioEngine(file_descriptor, queue_depth));
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "utils.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <utility>
+
+namespace nvme_sampler {
+
+/**
+ * Read-only memory mapping of a file or of its part (or an anonymous mapping if the file cannot be created).
+ */
+class MappedFile {
+    void *address{MAP_FAILED};
+    int64 size{0};
+
+public:
+    MappedFile() = default;
+
+    MappedFile(void *address, int64 size) : address(address), size(size) {}
+
+    MappedFile(MappedFile const &) = delete;
+
+    MappedFile &operator=(MappedFile const &) = delete;
+
+    ~MappedFile() {
+        if (this->address != MAP_FAILED) {
+            ::munmap(this->address, this->size);
+        }
+    }
+
+    // maps size bytes starting at page-aligned offset (size < 0: up to the end of the file);
+    // returns false if the file does not exist, aborts on other errors
+    bool open(std::string const &path, int64 offset = 0, int64 size = -1) {
+        const int32 file_descriptor = ::open(path.c_str(), O_RDONLY);
+        if (file_descriptor < 0 && errno == ENOENT) {
+            return false;
+        }
+        CHECK_SYSCALL(file_descriptor >= 0, "Failed to open file: " << path);
+
+        struct stat file_stat;
+        CHECK_SYSCALL(::fstat(file_descriptor, &file_stat) == 0, "fstat() failed: " << path);
+        CASSERT(offset >= 0 && offset <= file_stat.st_size && (size < 0 || offset + size <= file_stat.st_size),
+                "range [%ld, %ld) exceeds size of %s", offset, offset + size, path.c_str());
+        this->size = size < 0 ? file_stat.st_size - offset : size;
+        if (this->size > 0) {
+            this->address = ::mmap(nullptr, this->size, PROT_READ, MAP_SHARED, file_descriptor, offset);
+            CHECK_SYSCALL(this->address != MAP_FAILED, "mmap() failed: " << path);
+        }
+        CHECK_SYSCALL(::close(file_descriptor) == 0, "Failed to close file: " << path);
+        return true;
+    }
+
+    void swap(MappedFile &other) {
+        std::swap(this->address, other.address);
+        std::swap(this->size, other.size);
+    }
+
+    template<typename T>
+    T const *data() const {
+        return this->address == MAP_FAILED ? nullptr : reinterpret_cast<T const *>(this->address);
+    }
+
+    int64 get_size() const {
+        return this->size;
+    }
+};
+
+}
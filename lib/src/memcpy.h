@@ -1,39 +1,221 @@
 #pragma once
 
 #include "utils.h"
+#include "buffers.h"
 
+#include <algorithm>
 #include <cstring>
 #include <immintrin.h>
 
 namespace nvme_sampler {
 
-// Uses AVX2 VMOVNTDQ (i.e. with non-temporal hint) to copy aligned memory.
-inline void avx2nt_memcpy(void *__restrict dst, const void *__restrict src, size_t size) {
-    //    assert(size % 32 == 0);
-    //    assert((intptr_t(dst) & 31) == 0);
-    //    assert((intptr_t(src) & 31) == 0);
+/**
+ * Copy kernels used to scatter rows into batch blocks, picked at runtime by the features of the CPU (CPUID), so the library
+ * is built for baseline x86-64 and still uses AVX2 or AVX-512 where they are available.
+ *
+ * Streaming kernels write with non-temporal stores (batch blocks are read by the consumer much later, so they should not
+ * evict read buffers from caches); they copy the bytes up to the first vector-aligned destination address and the bytes
+ * after the last full vector with memcpy(), so any size and alignment works (e.g. 1016-byte rows).
+ */
+namespace Memcpy {
 
-    auto src_m256i = reinterpret_cast<const __m256i *>(src);
-    auto *dst_m256i = reinterpret_cast<__m256i *>(dst);
-    const int64 num_chunks = size / sizeof(__m256i);
+typedef void (*CopyFunction)(void *__restrict dst, const void *__restrict src, size_t size);
 
-    for (int64 chunk_idx = 0; chunk_idx < num_chunks; ++chunk_idx) {
-        const __m256i loaded = _mm256_stream_load_si256(src_m256i);
-        _mm256_stream_si256(dst_m256i, loaded);
-        src_m256i++;
-        dst_m256i++;
-    }
+/**
+ * Scatter loops specialized for a row size: row_idx-th row (rows + row_idx * row_stride_b) goes to destinations[row_idx].
+ * The size is a compile-time constant, so a row is copied by a fixed, unrolled sequence of stores with no size checks.
+ * Streaming variants need destinations aligned to SCATTER_ALIGNMENT.
+ */
+typedef void (*ScatterFunction)(byte *const *destinations, byte const *rows, int64 row_stride_b, int32 num_rows, int32 num_destinations);
+
+struct CopyKernel {
+    char const *name;
+    CopyFunction copy;
+    bool non_temporal; // store_fence() must be called before other threads read what was copied
+    bool (*is_supported)();
+    ScatterFunction (*select_scatter)(int64 row_size_b); // returns nullptr if no loop is specialized for that row size
+};
+
+// below that size streaming does not pay off: most of a copy would go through memcpy() anyway
+static const size_t MIN_STREAMING_SIZE = 256;
+
+// orders non-temporal stores before the stores that follow it (e.g. handing the batch block over to the consumer)
+inline void store_fence() {
     _mm_sfence();
 }
 
-template<bool large_size_aligned32>
-inline void smart_memcpy(void *__restrict dst, const void *__restrict src, size_t size) {
+// copies with memcpy() the head of size up to the first vector_size-aligned dst and returns the number of bytes copied
+inline size_t copy_head(void *__restrict dst, const void *__restrict src, size_t size, size_t vector_size) {
+    const size_t head = std::min(size, (vector_size - (reinterpret_cast<uintptr_t>(dst) & (vector_size - 1))) & (vector_size - 1));
+    ::memcpy(dst, src, head);
+    return head;
+}
+
+__attribute__((target("avx512f")))
+inline void avx512_stream_memcpy(void *__restrict dst, const void *__restrict src, size_t size) {
+    const size_t head = copy_head(dst, src, size, sizeof(__m512i));
+    auto dst_bytes = static_cast<byte *>(dst) + head;
+    auto src_bytes = static_cast<byte const *>(src) + head;
+    size -= head;
+
+    for (; size >= sizeof(__m512i); size -= sizeof(__m512i)) {
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(dst_bytes), _mm512_loadu_si512(src_bytes));
+        dst_bytes += sizeof(__m512i);
+        src_bytes += sizeof(__m512i);
+    }
+    ::memcpy(dst_bytes, src_bytes, size);
+}
+
+__attribute__((target("avx2")))
+inline void avx2_stream_memcpy(void *__restrict dst, const void *__restrict src, size_t size) {
+    const size_t head = copy_head(dst, src, size, sizeof(__m256i));
+    auto dst_bytes = static_cast<byte *>(dst) + head;
+    auto src_bytes = static_cast<byte const *>(src) + head;
+    size -= head;
+
+    for (; size >= sizeof(__m256i); size -= sizeof(__m256i)) {
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dst_bytes), _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src_bytes)));
+        dst_bytes += sizeof(__m256i);
+        src_bytes += sizeof(__m256i);
+    }
+    ::memcpy(dst_bytes, src_bytes, size);
+}
+
+// SSE2 is part of x86-64, so this kernel runs everywhere
+inline void sse2_stream_memcpy(void *__restrict dst, const void *__restrict src, size_t size) {
+    const size_t head = copy_head(dst, src, size, sizeof(__m128i));
+    auto dst_bytes = static_cast<byte *>(dst) + head;
+    auto src_bytes = static_cast<byte const *>(src) + head;
+    size -= head;
+
+    for (; size >= sizeof(__m128i); size -= sizeof(__m128i)) {
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dst_bytes), _mm_loadu_si128(reinterpret_cast<__m128i const *>(src_bytes)));
+        dst_bytes += sizeof(__m128i);
+        src_bytes += sizeof(__m128i);
+    }
+    ::memcpy(dst_bytes, src_bytes, size);
+}
+
+inline void scalar_memcpy(void *__restrict dst, const void *__restrict src, size_t size) {
     ::memcpy(dst, src, size);
+}
+
+static const int64 SCATTER_ALIGNMENT = 64;
+
+// destinations[num_rows, num_destinations) are only prefetched: they are the rows of the next call
+static const int32 PREFETCH_DISTANCE = 8;
+
+// regular stores: the destination line is read before it is written, so it is prefetched (for writing) in advance
+template<size_t SIZE>
+struct CachedScatter {
+    static void scatter(byte *const *destinations, byte const *rows, int64 row_stride_b, int32 num_rows, int32 num_destinations) {
+        for (int32 row_idx = 0; row_idx < num_rows; ++row_idx) {
+            if (row_idx + PREFETCH_DISTANCE < num_destinations) {
+                for (size_t offset = 0; offset < SIZE; offset += SCATTER_ALIGNMENT) {
+                    __builtin_prefetch(destinations[row_idx + PREFETCH_DISTANCE] + offset, 1);
+                }
+            }
+            ::memcpy(destinations[row_idx], rows + row_idx * row_stride_b, SIZE);
+        }
+    }
+};
+
+// non-temporal stores do not read destination lines, so there is nothing to prefetch
+template<size_t SIZE>
+struct Avx512StreamScatter {
+    static_assert(SIZE % sizeof(__m512i) == 0, "row size must be a multiple of the vector size");
+
+    __attribute__((target("avx512f")))
+    static void scatter(byte *const *destinations, byte const *rows, int64 row_stride_b, int32 num_rows, int32) {
+        for (int32 row_idx = 0; row_idx < num_rows; ++row_idx) {
+            auto dst = reinterpret_cast<__m512i *>(destinations[row_idx]);
+            auto src = reinterpret_cast<__m512i const *>(rows + row_idx * row_stride_b);
+            for (size_t vector_idx = 0; vector_idx < SIZE / sizeof(__m512i); ++vector_idx) {
+                _mm512_stream_si512(dst + vector_idx, _mm512_loadu_si512(src + vector_idx));
+            }
+        }
+    }
+};
+
+template<size_t SIZE>
+struct Avx2StreamScatter {
+    static_assert(SIZE % sizeof(__m256i) == 0, "row size must be a multiple of the vector size");
+
+    __attribute__((target("avx2")))
+    static void scatter(byte *const *destinations, byte const *rows, int64 row_stride_b, int32 num_rows, int32) {
+        for (int32 row_idx = 0; row_idx < num_rows; ++row_idx) {
+            auto dst = reinterpret_cast<__m256i *>(destinations[row_idx]);
+            auto src = reinterpret_cast<__m256i const *>(rows + row_idx * row_stride_b);
+            for (size_t vector_idx = 0; vector_idx < SIZE / sizeof(__m256i); ++vector_idx) {
+                _mm256_stream_si256(dst + vector_idx, _mm256_loadu_si256(src + vector_idx));
+            }
+        }
+    }
+};
+
+template<size_t SIZE>
+struct Sse2StreamScatter {
+    static_assert(SIZE % sizeof(__m128i) == 0, "row size must be a multiple of the vector size");
+
+    static void scatter(byte *const *destinations, byte const *rows, int64 row_stride_b, int32 num_rows, int32) {
+        for (int32 row_idx = 0; row_idx < num_rows; ++row_idx) {
+            auto dst = reinterpret_cast<__m128i *>(destinations[row_idx]);
+            auto src = reinterpret_cast<__m128i const *>(rows + row_idx * row_stride_b);
+            for (size_t vector_idx = 0; vector_idx < SIZE / sizeof(__m128i); ++vector_idx) {
+                _mm_stream_si128(dst + vector_idx, _mm_loadu_si128(src + vector_idx));
+            }
+        }
+    }
 };
 
-template<>
-inline void smart_memcpy<true>(void *__restrict dst, const void *__restrict src, size_t size) {
-    avx2nt_memcpy(dst, src, size);
+template<template<size_t> class Scatter>
+ScatterFunction select_scatter(int64 row_size_b) {
+    switch (row_size_b) {
+        case 64:
+            return Scatter<64>::scatter;
+        case 128:
+            return Scatter<128>::scatter;
+        case 256:
+            return Scatter<256>::scatter;
+        case 512:
+            return Scatter<512>::scatter;
+        case 1024:
+            return Scatter<1024>::scatter;
+        case 4096:
+            return Scatter<4096>::scatter;
+        default:
+            return nullptr;
+    }
+}
+
+// best first
+static const CopyKernel KERNELS[] = {
+        {.name = "avx512_stream", .copy = avx512_stream_memcpy, .non_temporal = true,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx512f") != 0; },
+                .select_scatter = select_scatter<Avx512StreamScatter>},
+        {.name = "avx2_stream", .copy = avx2_stream_memcpy, .non_temporal = true,
+                .is_supported = []() { __builtin_cpu_init(); return __builtin_cpu_supports("avx2") != 0; },
+                .select_scatter = select_scatter<Avx2StreamScatter>},
+        {.name = "sse2_stream", .copy = sse2_stream_memcpy, .non_temporal = true, .is_supported = []() { return true; },
+                .select_scatter = select_scatter<Sse2StreamScatter>},
+        {.name = "memcpy", .copy = scalar_memcpy, .non_temporal = false, .is_supported = []() { return true; },
+                .select_scatter = select_scatter<CachedScatter>}
+};
+
+// the best kernel supported by the CPU for copies of at least min_copy_size bytes
+inline CopyKernel const &select_kernel(size_t min_copy_size) {
+    CopyKernel const &scalar_kernel = KERNELS[sizeof(KERNELS) / sizeof(KERNELS[0]) - 1];
+    if (min_copy_size < MIN_STREAMING_SIZE) {
+        return scalar_kernel;
+    }
+    for (auto const &kernel : KERNELS) {
+        if (kernel.is_supported()) {
+            return kernel;
+        }
+    }
+    return scalar_kernel;
+}
+
 }
 
 }
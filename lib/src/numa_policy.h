@@ -0,0 +1,146 @@
+#pragma once
+
+#include "utils.h"
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nvme_sampler {
+namespace Numa {
+
+static const int32 UNKNOWN_NODE = -1;
+static const int32 MAX_NUM_NODES = 1024;
+
+inline bool read_sysfs_int(std::string const &path, int32 &value) {
+    std::ifstream file(path);
+    return static_cast<bool>(file >> value);
+}
+
+inline bool path_exists(std::string const &path) {
+    struct stat path_stat;
+    return ::stat(path.c_str(), &path_stat) == 0;
+}
+
+inline std::string resolve_path(std::string const &path) {
+    char resolved[PATH_MAX];
+    return ::realpath(path.c_str(), resolved) ? std::string(resolved) : std::string();
+}
+
+// Returns NUMA node of the block device under /sys/block (follows md/dm slaves; all of them must share the node).
+inline int32 get_block_device_node(std::string const &sysfs_dir, int32 depth = 0) {
+    if (depth > 8 || sysfs_dir.empty()) {
+        return UNKNOWN_NODE;
+    }
+
+    if (path_exists(sysfs_dir + "/partition")) {
+        return get_block_device_node(resolve_path(sysfs_dir + "/.."), depth + 1);
+    }
+
+    int32 node;
+    dirent *entry;
+    for (auto const &candidate : {"/device/numa_node", "/device/device/numa_node"}) {
+        if (read_sysfs_int(sysfs_dir + candidate, node) && node >= 0) {
+            return node;
+        }
+    }
+
+    // md RAID or device mapper: use the common node of member devices
+    std::set<int32> slave_nodes;
+    const std::string slaves_dir = sysfs_dir + "/slaves";
+    std::unique_ptr<DIR, int (*)(DIR *)> slaves(::opendir(slaves_dir.c_str()), ::closedir);
+    while (slaves && (entry = ::readdir(slaves.get())) != nullptr) {
+        if (entry->d_name[0] != '.') {
+            slave_nodes.insert(get_block_device_node(resolve_path(slaves_dir + "/" + entry->d_name), depth + 1));
+        }
+    }
+
+    return slave_nodes.size() == 1 ? *slave_nodes.begin() : UNKNOWN_NODE;
+}
+
+// NUMA node of the device (NVMe controller) holding the file or UNKNOWN_NODE
+inline int32 get_file_node(int32 file_descriptor) {
+    struct stat file_stat;
+    if (::fstat(file_descriptor, &file_stat) != 0) {
+        return UNKNOWN_NODE;
+    }
+
+    std::stringstream sysfs_path;
+    sysfs_path << "/sys/dev/block/" << major(file_stat.st_dev) << ":" << minor(file_stat.st_dev);
+    return get_block_device_node(resolve_path(sysfs_path.str()));
+}
+
+// NUMA node of the CPU the calling thread runs on
+inline int32 get_current_node() {
+    unsigned cpu, node;
+    if (::syscall(SYS_getcpu, &cpu, &node, nullptr) != 0) {
+        return UNKNOWN_NODE;
+    }
+    return static_cast<int32>(node);
+}
+
+// parses /sys/devices/system/node/nodeX/cpulist (e.g. "0-15,32-47")
+inline std::vector<int32> get_node_cpus(int32 node) {
+    std::vector<int32> cpus;
+    std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+    std::string range;
+    while (std::getline(file, range, ',')) {
+        int32 first, last;
+        const int32 num_parsed = std::sscanf(range.c_str(), "%d-%d", &first, &last);
+        if (num_parsed < 1) {
+            continue;
+        }
+        for (int32 cpu = first; cpu <= (num_parsed == 2 ? last : first); ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+// pins the thread to CPUs of the node; returns false if that's not possible
+inline bool pin_thread(std::thread &thread, int32 node) {
+    const std::vector<int32> cpus = get_node_cpus(node);
+    if (node == UNKNOWN_NODE || cpus.empty()) {
+        return false;
+    }
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int32 cpu : cpus) {
+        CPU_SET(cpu, &cpu_set);
+    }
+    return ::pthread_setaffinity_np(thread.native_handle(), sizeof(cpu_set), &cpu_set) == 0;
+}
+
+// binds (and migrates already touched) pages of the memory range to the node; returns false if that's not possible
+inline bool bind_memory(void *address, int64 size, int32 node) {
+    if (node == UNKNOWN_NODE || node >= MAX_NUM_NODES || size <= 0) {
+        return false;
+    }
+
+    const int64 page_size = ::sysconf(_SC_PAGESIZE);
+    const uint64 start = reinterpret_cast<uint64>(address) / page_size * page_size;
+    const uint64 end = align_up(reinterpret_cast<uint64>(address) + size, static_cast<int32>(page_size));
+
+    unsigned long node_mask[MAX_NUM_NODES / (8 * sizeof(unsigned long))] = {};
+    node_mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+
+    return ::syscall(SYS_mbind, start, end - start, MPOL_BIND, node_mask, MAX_NUM_NODES + 1, MPOL_MF_MOVE) == 0;
+}
+
+}
+}
@@ -1,9 +1,18 @@
 #include "nvme_sampler.h"
+#include "sampler_client.h"
 #include "nvme_api.h"
 
 namespace nvme_sampler {
 namespace api {
 
+static_assert(sizeof(SamplerCheckpoint) == sizeof(nvme_sampler::SamplerCheckpoint), "api::SamplerCheckpoint does not match");
+static_assert(sizeof(SamplerCheckpoint::epoch_positions) == sizeof(nvme_sampler::SamplerCheckpoint::epoch_positions),
+              "api::SamplerCheckpoint does not match");
+
+struct ClientHandle {
+    SamplerClient client;
+};
+
 struct SamplerHandle {
     void *user_data; // order is important
     NvmeSampler *sampler;
@@ -14,37 +23,60 @@ struct SamplerHandle {
 handle init_sampler(UserDataPtr user_data,
                     AllocatorFun allocator,
                     DeleterFun deleter,
-                    std::string const &file_path,
+                    std::vector<std::string> const &file_paths,
                     int64_t num_rows,
                     int64_t row_size,
-                    int64_t max_batch_elements,
-                    int64_t max_num_threads,
-                    int64_t memory_usage_limit_b,
-                    int32_t seed
+                    SamplerConfig const &config,
+                    SamplerCheckpoint const *checkpoint
 ) {
+    CASSERT(config.projection_size % 2 == 0, "projection must consist of (offset, length) pairs, got %ld values", config.projection_size);
+
+    std::vector<ByteRange> projection_ranges;
+    for (int64_t idx = 0; idx < config.projection_size; idx += 2) {
+        projection_ranges.push_back(ByteRange{.offset = config.projection[idx], .length = config.projection[idx + 1]});
+    }
 
     TensorDescription tensor_description = {
             .num_rows = num_rows,
             .row_size_b = row_size,
-            .file_path = file_path
+            .file_paths = file_paths
     };
 
-    SamplerConfig config = {
-            .max_batch_elements = max_batch_elements,
-            .max_num_threads = max_num_threads,
-            .memory_usage_limit_b = memory_usage_limit_b,
-            .seed = seed
+    nvme_sampler::SamplerConfig sampler_config = {
+            .max_batch_elements = config.max_batch_elements,
+            .max_num_threads = config.max_num_threads,
+            .memory_usage_limit_b = config.memory_usage_limit_b,
+            .seed = config.seed,
+            .io_engine = static_cast<IoEngineType>(config.io_engine),
+            .io_queue_depth = config.io_queue_depth,
+            .num_batch_blocks = config.num_batch_blocks,
+            .zero_copy = config.zero_copy != 0,
+            .numa_policy = static_cast<NumaPolicyType>(config.numa_policy),
+            .sampling_mode = static_cast<SamplingModeType>(config.sampling_mode),
+            .weights_path = config.weights_path ? config.weights_path : "",
+            .projection = projection_ranges,
+            .storage_format = static_cast<StorageFormatType>(config.storage_format),
+            .huge_pages = static_cast<HugePagesPolicyType>(config.huge_pages),
+            .lock_memory = config.lock_memory != 0,
+            .value_format = static_cast<ValueFormatType>(config.value_format),
+            .int8_scales = std::vector<float>(config.int8_scales, config.int8_scales + config.int8_columns),
+            .int8_offsets = std::vector<float>(config.int8_offsets, config.int8_offsets + config.int8_columns),
+            .submission_order = static_cast<SubmissionOrderType>(config.submission_order),
+            .stripe_size_b = config.stripe_size_b,
+            .num_stripe_devices = config.num_stripe_devices,
+            .auto_tune = config.auto_tune != 0
     };
 
     SamplerHandle *handle = new SamplerHandle{
             .user_data = user_data,
             .sampler = new NvmeSampler(
                     tensor_description,
-                    config,
+                    sampler_config,
                     BatchBlocks::Allocator{
                             .allocator = [allocator, user_data](size_t size) { return allocator(user_data, size); },
                             .deleter = [deleter, user_data](byte *addr) { return deleter(user_data, addr); }
-                    }),
+                    },
+                    reinterpret_cast<nvme_sampler::SamplerCheckpoint const *>(checkpoint)),
             .allocator = allocator,
             .deleter = deleter,
     };
@@ -60,5 +92,144 @@ byte *read_batch(handle sampler, long batch_size) {
     return sampler->sampler->get_next_batch(batch_size);
 }
 
+int64_t create_consumer(handle sampler) {
+    return sampler->sampler->create_consumer();
+}
+
+byte *read_batch(handle sampler, int64_t consumer, long batch_size) {
+    NvmeSampler &nvme_sampler = *sampler->sampler;
+    return nvme_sampler.get_next_batch(nvme_sampler.get_consumer(consumer), batch_size);
+}
+
+byte *lease_batch(handle sampler, int64_t consumer, long batch_size) {
+    NvmeSampler &nvme_sampler = *sampler->sampler;
+    return nvme_sampler.lease_next_batch(nvme_sampler.get_consumer(consumer), batch_size);
+}
+
+byte *try_read_batch(handle sampler, int64_t consumer, long batch_size) {
+    NvmeSampler &nvme_sampler = *sampler->sampler;
+    return nvme_sampler.try_get_next_batch(nvme_sampler.get_consumer(consumer), batch_size);
+}
+
+byte *lease_batch(handle sampler, long batch_size) {
+    return sampler->sampler->lease_next_batch(batch_size);
+}
+
+void release_batch(handle sampler, byte *batch) {
+    sampler->sampler->release_batch(batch);
+}
+
+byte *try_read_batch(handle sampler, long batch_size) {
+    return sampler->sampler->try_get_next_batch(batch_size);
+}
+
+int32_t get_ready_fd(handle sampler) {
+    return sampler->sampler->get_ready_event_fd();
+}
+
+void set_ready_callback(handle sampler, ReadyCallbackFun callback, UserDataPtr callback_data) {
+    if (callback == nullptr) {
+        sampler->sampler->set_ready_callback(nullptr);
+    } else {
+        sampler->sampler->set_ready_callback([callback, callback_data]() { callback(callback_data); });
+    }
+}
+
+int64_t get_epoch(handle sampler) {
+    return sampler->sampler->get_epoch();
+}
+
+void get_checkpoint(handle sampler, SamplerCheckpoint *checkpoint) {
+    const nvme_sampler::SamplerCheckpoint position = sampler->sampler->get_checkpoint();
+    std::memcpy(checkpoint, &position, sizeof(position));
+}
+
+static void add_worker_counters(WorkerCounters const &counters, WorkerStats *stats, LatencySummary *latency) {
+    stats->reads_submitted += counters.reads_submitted.get();
+    stats->reads_completed += counters.reads_completed.get();
+    stats->bytes_read += counters.bytes_read.get();
+    stats->bytes_wasted += counters.bytes_wasted.get();
+    stats->samples_read += counters.samples_read.get();
+    stats->io_wait_ns += counters.io_wait_ns.get();
+    stats->scatter_ns += counters.scatter_ns.get();
+    stats->decompress_ns += counters.decompress_ns.get();
+    stats->idle_ns += counters.idle_ns.get();
+    latency->add(counters.io_latency);
+}
+
+static void set_latency_quantiles(LatencySummary const &latency, WorkerStats *stats) {
+    stats->io_latency_p50_ns = latency.quantile_ns(0.5);
+    stats->io_latency_p90_ns = latency.quantile_ns(0.9);
+    stats->io_latency_p99_ns = latency.quantile_ns(0.99);
+    stats->io_latency_p999_ns = latency.quantile_ns(0.999);
+}
+
+void get_stats(handle sampler, SamplerStats *stats) {
+    NvmeSampler const &nvme_sampler = *sampler->sampler;
+
+    *stats = SamplerStats{};
+    stats->elapsed_ns = nvme_sampler.get_elapsed_time_ns();
+    stats->num_workers = nvme_sampler.get_num_workers();
+
+    LatencySummary latency;
+    for (int64_t worker_idx = 0; worker_idx < stats->num_workers; ++worker_idx) {
+        add_worker_counters(nvme_sampler.get_worker_counters(worker_idx), &stats->workers, &latency);
+    }
+    set_latency_quantiles(latency, &stats->workers);
+
+    stats->num_consumers = nvme_sampler.get_num_consumers();
+    for (int64_t consumer_idx = 0; consumer_idx < stats->num_consumers; ++consumer_idx) {
+        ConsumerCounters const &consumer_counters = nvme_sampler.get_consumer_counters(consumer_idx);
+        stats->blocks_consumed += consumer_counters.blocks_consumed.get();
+        stats->batches_consumed += consumer_counters.batches_consumed.get();
+        stats->samples_consumed += consumer_counters.samples_consumed.get();
+        stats->consumer_wait_ns += consumer_counters.wait_ns.get();
+    }
+
+    MemoryStats const memory_stats = nvme_sampler.get_memory_stats();
+    stats->batch_blocks_page_size_b = memory_stats.batch_blocks_page_size_b;
+    stats->read_buffers_page_size_b = memory_stats.read_buffers_page_size_b;
+    stats->locked_memory_b = memory_stats.locked_b;
+    stats->num_active_workers = nvme_sampler.get_num_active_workers();
+    stats->io_queue_depth = nvme_sampler.get_io_queue_depth();
+}
+
+void get_worker_stats(handle sampler, int64_t worker_idx, WorkerStats *stats) {
+    *stats = WorkerStats{};
+
+    LatencySummary latency;
+    add_worker_counters(sampler->sampler->get_worker_counters(worker_idx), stats, &latency);
+    set_latency_quantiles(latency, stats);
+}
+
+
+client_handle connect_sampler(std::string const &socket_path, long batch_size, long prefetch_batches) {
+    return new ClientHandle{.client = {socket_path, batch_size, prefetch_batches}};
+}
+
+void disconnect_sampler(client_handle client) {
+    delete client;
+}
+
+byte *client_read_batch(client_handle client) {
+    return client->client.get_next_batch();
+}
+
+int64_t get_client_row_size(client_handle client) {
+    return client->client.get_row_size_b();
+}
+
+int32_t get_client_data_fd(client_handle client) {
+    return client->client.get_data_memory().get_file_descriptor();
+}
+
+int64_t get_client_data_size(client_handle client) {
+    return client->client.get_data_memory().get_size();
+}
+
+byte *get_client_data(client_handle client) {
+    return client->client.get_data_memory().get();
+}
+
 }
 }
@@ -1,11 +1,16 @@
 // Basic API that can be used to integrate NvmeSampler with PyTorch or torch
 
+#include <string>
+#include <vector>
+
 namespace nvme_sampler {
 namespace api {
 
 struct SamplerHandle;
+struct ClientHandle;
 
 typedef SamplerHandle *handle;
+typedef ClientHandle *client_handle;
 typedef unsigned char byte;
 typedef void *UserDataPtr;
 
@@ -13,17 +18,130 @@ typedef byte *(*AllocatorFun)(UserDataPtr, size_t);
 
 typedef void(*DeleterFun)(UserDataPtr, byte *);
 
-// to make it deterministic set seed to some value AND max_num_threads to 1
+typedef void(*ReadyCallbackFun)(UserDataPtr);
+
+// Counters of a single worker thread (or all of them). Times are in nanoseconds.
+struct WorkerStats {
+    int64_t reads_submitted;
+    int64_t reads_completed;
+    int64_t bytes_read;
+    int64_t bytes_wasted; // sector alignment padding: read from disk but never copied to a batch block
+    int64_t samples_read;
+    int64_t io_wait_ns; // submitting reads and waiting for their completion
+    int64_t scatter_ns; // copying finished reads into batch blocks
+    int64_t decompress_ns; // decompressing chunks of compressed files
+    int64_t idle_ns; // waiting for work: all batch blocks are filled and wait for the consumer
+    int64_t io_latency_p50_ns;
+    int64_t io_latency_p90_ns;
+    int64_t io_latency_p99_ns;
+    int64_t io_latency_p999_ns;
+};
+
+struct SamplerStats {
+    int64_t elapsed_ns; // since sampler creation
+    int64_t num_workers;
+    int64_t num_consumers;
+    WorkerStats workers; // sum over all workers
+    int64_t blocks_consumed;
+    int64_t batches_consumed;
+    int64_t samples_consumed;
+    int64_t consumer_wait_ns; // time read_batch() spent waiting for workers (summed over consumers)
+    int64_t batch_blocks_page_size_b; // 2 MiB with transparent huge pages means they were requested, not that the kernel provided them
+    int64_t read_buffers_page_size_b; // 0 if workers have no read buffers (zero-copy mode)
+    int64_t locked_memory_b;
+    int64_t num_active_workers; // below num_workers only if lowered by the auto-tuner
+    int64_t io_queue_depth; // of every active worker, below io_queue_depth only if lowered by the auto-tuner
+};
+
+// Position of a sampler in its sequence of batches (get_checkpoint()); must match nvme_sampler::SamplerCheckpoint.
+// It is plain data: store its bytes with the model checkpoint and pass them to init_sampler() after a restart.
+struct SamplerCheckpoint {
+    int64_t version;
+    int64_t seed;
+    int64_t num_rows;
+    int64_t num_shards;
+    int64_t max_batch_elements;
+    int64_t num_batches_in_block;
+    int64_t sampling_mode;
+    int64_t sequence_number; // of the batch block read at the checkpoint
+    int64_t read_idx; // of the next sample in that block
+    int64_t epoch;
+    int64_t epoch_positions[64];
+};
+
+// Options of a sampler, converted to nvme_sampler::SamplerConfig by init_sampler(); must match SamplerConfig of the C
+// binding. It is plain data: enums are passed as their values, flags as 0 or 1 and arrays as a pointer and a length (the
+// arrays are copied by init_sampler()).
+//
+// seed: batches depend only on it and on the order of read calls, not on max_num_threads, io_engine or io_queue_depth
+//       (except in epoch sampling mode, where workers take chunks from a shared cursor as they go)
+// io_engine: 0 - libaio, 1 - io_uring, 2 - io_uring with SQPOLL (falls back to libaio if io_uring is unavailable)
+// io_queue_depth: number of reads each worker thread keeps in flight
+// num_batch_blocks: number of batch blocks memory_usage_limit_b is split into (at least 2); more, smaller blocks
+//                   shorten the longest possible wait for the next block
+// zero_copy: if row_size is a multiple of 512 bytes, read rows directly into batch blocks (skips the copy from read buffers)
+// numa_policy: 0 - none, 1 - pin workers and their buffers to the NUMA node of their drive, batch blocks to the caller's node
+// sampling_mode: 0 - chunks are drawn with replacement, 1 - epochs: every chunk is read once per epoch (see get_epoch())
+// weights_path: file of (int64 first_row, double weight) records setting relative sampling probability of row ranges
+//               (nullptr: uniform); alias tables built from it are cached next to it in <weights_path>.alias<shard_idx>
+// projection: flattened (offset, length) byte ranges of a row copied, packed in this order, into batches (empty: whole rows);
+//             batches then have rows of the total length of the ranges and sectors outside of the ranges are not read
+// storage_format: 0 - raw rows, 1 - compressed containers created by lib/bin/nvme_pack (chunks are decompressed by workers)
+// huge_pages: 0 - 4 KiB pages, 1 - transparent huge pages, 2 - 2 MiB HugeTLB pages, 3 - 1 GiB HugeTLB pages (falling back
+//             to smaller pages if the hugetlbfs pool is empty); HugeTLB pages are used by read buffers only, batch blocks
+//             come from allocator and can use transparent huge pages
+// lock_memory: mlock() read buffers and batch blocks
+// value_format: 0 - float32, 1 - float16, 2 - bfloat16, 3 - int8 values in dataset files (row_size and projection are in
+//               bytes of the files); workers widen them to float32, so batches are always float32
+// int8_scales, int8_offsets: int8 values only, scale and offset of every column of a row (value * scale + offset);
+//                            empty: 1 and 0
+// submission_order: 0 - reads are sent as drawn, 1 - sorted by offset within every submission window, 2 - sorted by offset
+//                   and interleaved over the members of a RAID-0 array (batches are the same in every order)
+// stripe_size_b, num_stripe_devices: RAID-0 geometry for submission_order 2; 0: read from sysfs (md RAID-0 arrays)
+// auto_tune: adjust io_queue_depth and the number of active worker threads while running, by measured samples per second
+//            and read latency (max_num_threads and io_queue_depth become upper bounds; batches stay the same)
+struct SamplerConfig {
+    int64_t max_batch_elements;
+    int64_t max_num_threads;
+    int64_t memory_usage_limit_b;
+    int32_t seed;
+    int32_t io_engine;
+    int32_t io_queue_depth;
+    int32_t num_batch_blocks;
+    int32_t zero_copy;
+    int32_t numa_policy;
+    int32_t sampling_mode;
+    char const *weights_path;
+    int64_t const *projection;
+    int64_t projection_size; // 2 values per range
+    int32_t storage_format;
+    int32_t huge_pages;
+    int32_t lock_memory;
+    int32_t value_format;
+    float const *int8_scales; // int8_columns values each
+    float const *int8_offsets;
+    int64_t int8_columns;
+    int32_t submission_order;
+    int64_t stripe_size_b;
+    int32_t num_stripe_devices;
+    int32_t auto_tune;
+};
+
+// Workers read rows a chunk at a time. A chunk read to complete a column of a batch block takes only some of its rows:
+// those following a random one (wrapping around to the first row of the chunk), so every row of a chunk is equally likely.
+//
+// file_paths: dataset file or shards of the dataset (e.g. one per NVMe drive); each shard gets its own worker threads
+// checkpoint: nullptr or a checkpoint of a sampler of the same dataset and parameters (the same seed, max_batch_elements,
+//             memory_usage_limit_b, num_batch_blocks, sampling_mode and files) to continue its sequence of batches from;
+//             only the batch blocks from the checkpoint on are read
 handle init_sampler(UserDataPtr user_data,
                     AllocatorFun allocator,
                     DeleterFun deleter,
-                    std::string const &file_path,
+                    std::vector<std::string> const &file_paths,
                     int64_t num_rows,
                     int64_t row_size,
-                    int64_t max_batch_elements,
-                    int64_t max_num_threads,
-                    int64_t memory_usage_limit_b,
-                    int32_t seed
+                    SamplerConfig const &config,
+                    SamplerCheckpoint const *checkpoint
 );
 
 // Destroys sampler. Sampler destruction uses deleter to deallocate batch buffer.
@@ -32,5 +150,71 @@ void destroy_sampler(handle sampler);
 
 byte *read_batch(handle sampler, long batch_size);
 
+// Like read_batch(), but the batch stays valid (its batch block is not refilled) until release_batch(), so several batches
+// can be kept without copying. Every leased batch keeps its whole block out of rotation: leased batches should come from
+// fewer than num_batch_blocks - 1 blocks, otherwise read_batch() waits forever.
+byte *lease_batch(handle sampler, long batch_size);
+
+// Releases a batch returned by lease_batch(); may be called from any thread.
+void release_batch(handle sampler, byte *batch);
+
+// Non-blocking read_batch(): returns nullptr if the next batch needs a batch block that is not filled yet.
+byte *try_read_batch(handle sampler, long batch_size);
+
+// eventfd (owned by the sampler) readable while a batch may be ready (a filled batch block is waiting or the block being
+// read has batches left), for poll()/epoll()/asyncio loops: call try_read_batch() until it returns nullptr, then wait for
+// the descriptor. Reading it is up to the sampler.
+int32_t get_ready_fd(handle sampler);
+
+// Sets callback(callback_data) called by a worker thread whenever a batch block is filled (callback nullptr: removes it).
+// The callback must be short and must not use the sampler; after this function returns the previous one is not running.
+void set_ready_callback(handle sampler, ReadyCallbackFun callback, UserDataPtr callback_data);
+
+// Registers a consumer (returns its index) that reads batches concurrently with other consumers of the same sampler, e.g.
+// one per data-feeding thread. Consumer 0 always exists and is used by read_batch() etc. without the consumer argument.
+// Each consumer must be used by one thread at a time and keeps its current batch block out of rotation until it moves to
+// the next one, so num_batch_blocks should exceed the number of consumers by at least 2.
+int64_t create_consumer(handle sampler);
+
+byte *read_batch(handle sampler, int64_t consumer, long batch_size);
+
+byte *lease_batch(handle sampler, int64_t consumer, long batch_size);
+
+byte *try_read_batch(handle sampler, int64_t consumer, long batch_size);
+
+// Epoch of recently read batches (sampling_mode 1, otherwise 0). It grows by one roughly every num_rows samples;
+// batches read around the boundary may contain samples of both epochs.
+int64_t get_epoch(handle sampler);
+
+// Position after the batches read so far (with several consumers: the position in the block they currently share).
+void get_checkpoint(handle sampler, SamplerCheckpoint *checkpoint);
+
+// Statistics can be read at any time (also from other threads) and cost nothing when not read.
+void get_stats(handle sampler, SamplerStats *stats);
+
+// Fills stats of the worker_idx-th worker thread (0 <= worker_idx < SamplerStats::num_workers).
+void get_worker_stats(handle sampler, int64_t worker_idx, WorkerStats *stats);
+
+
+// Connects to a sampler server (lib/bin/nvme_sampler_server) that serves batches to many processes from one set of
+// worker threads and batch blocks in shared memory. The server keeps prefetch_batches batches of batch_size rows
+// leased for the client (fewer than 256).
+client_handle connect_sampler(std::string const &socket_path, long batch_size, long prefetch_batches);
+
+void disconnect_sampler(client_handle client);
+
+// The batch stays valid until the next call; returns nullptr if the server is gone.
+byte *client_read_batch(client_handle client);
+
+// Size of rows in batches (smaller than the row size of the dataset if the server uses a projection).
+int64_t get_client_row_size(client_handle client);
+
+// memfd of the memory batches are read from (owned by the client)
+int32_t get_client_data_fd(client_handle client);
+
+int64_t get_client_data_size(client_handle client);
+
+byte *get_client_data(client_handle client);
+
 }
 }
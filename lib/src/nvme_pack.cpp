@@ -0,0 +1,139 @@
+// Packs a raw dataset file into a compressed container (see compression.h), which can be sampled with storage_format 1.
+//
+// usage: nvme_pack input_path output_path row_size_b [lz4|zstd] [chunk_size_b] [level] [num_threads]
+
+#include "compression.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+using namespace nvme_sampler;
+using SamplingParametersCalculator::PAGE_SIZE;
+using SamplingParametersCalculator::SECTOR_SIZE;
+
+static void read_all(int32 file_descriptor, byte *data, int64 size, int64 offset) {
+    while (size > 0) {
+        const ssize_t result = ::pread(file_descriptor, data, size, offset);
+        CHECK_SYSCALL(result > 0, "pread() failed at offset " << offset);
+        data += result;
+        size -= result;
+        offset += result;
+    }
+}
+
+static void write_all(int32 file_descriptor, byte const *data, int64 size, int64 offset) {
+    while (size > 0) {
+        const ssize_t result = ::pwrite(file_descriptor, data, size, offset);
+        CHECK_SYSCALL(result > 0, "pwrite() failed at offset " << offset);
+        data += result;
+        size -= result;
+        offset += result;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc < 4 || argc > 8) {
+        fprintf(stderr, "usage: %s input_path output_path row_size_b [lz4|zstd] [chunk_size_b] [level] [num_threads]\n", argv[0]);
+        return 1;
+    }
+
+    const std::string input_path = argv[1];
+    const std::string output_path = argv[2];
+    const int64 row_size_b = std::atol(argv[3]);
+    const std::string codec_name = argc > 4 ? argv[4] : "zstd";
+    const int64 chunk_size_b = argc > 5 ? std::atol(argv[5]) : SamplingParametersCalculator::MAX_CHUNK_SIZE;
+    const int32 level = argc > 6 ? std::atoi(argv[6]) : 3;
+    const int32 num_threads = argc > 7 ? std::atoi(argv[7]) : 8;
+
+    CASSERT(codec_name == "lz4" || codec_name == "zstd", "unknown codec: %s", codec_name.c_str());
+    CASSERT(row_size_b > 0 && chunk_size_b >= row_size_b, "invalid row_size_b (%ld) or chunk_size_b (%ld)", row_size_b, chunk_size_b);
+    CASSERT(num_threads > 0, "invalid num_threads: %d", num_threads);
+    const CompressionCodecType codec = codec_name == "lz4" ? Lz4CompressionCodec : ZstdCompressionCodec;
+
+    const int32 input_descriptor = ::open(input_path.c_str(), O_RDONLY);
+    CHECK_SYSCALL(input_descriptor >= 0, "Failed to open file: " << input_path);
+    struct stat input_stat;
+    CHECK_SYSCALL(::fstat(input_descriptor, &input_stat) == 0, "fstat() failed: " << input_path);
+    CASSERT(input_stat.st_size > 0 && input_stat.st_size % row_size_b == 0, "size of %s (%ld) is not a multiple of row size",
+            input_path.c_str(), static_cast<int64>(input_stat.st_size));
+    ::posix_fadvise(input_descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    const int32 output_descriptor = ::open(output_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    CHECK_SYSCALL(output_descriptor >= 0, "Failed to create file: " << output_path);
+
+    const int64 num_rows = input_stat.st_size / row_size_b;
+    const int64 chunk_rows = chunk_size_b / row_size_b;
+    const int64 num_chunks = (num_rows + chunk_rows - 1) / chunk_rows;
+    const int64 raw_chunk_size_b = chunk_rows * row_size_b;
+    const int64 compress_bound_b = Compression::get_compress_bound(codec, raw_chunk_size_b);
+
+    // chunks are read and written in groups, each group is compressed by all threads
+    const int64 group_size = num_threads * 16L;
+    std::vector<byte> raw_chunks(group_size * raw_chunk_size_b);
+    std::vector<byte> compressed_chunks(group_size * compress_bound_b);
+    std::vector<int64> compressed_sizes(group_size);
+    std::vector<ChunkIndexEntry> index(num_chunks);
+
+    int64 offset = CompressedContainer::DATA_OFFSET;
+    int64 max_read_size_b = SECTOR_SIZE;
+    for (int64 first_chunk = 0; first_chunk < num_chunks; first_chunk += group_size) {
+        const int64 num_group_chunks = std::min(group_size, num_chunks - first_chunk);
+        const int64 first_row = first_chunk * chunk_rows;
+        const int64 num_group_rows = std::min(num_group_chunks * chunk_rows, num_rows - first_row);
+        read_all(input_descriptor, raw_chunks.data(), num_group_rows * row_size_b, first_row * row_size_b);
+
+        std::vector<std::thread> threads;
+        for (int32 thread_idx = 0; thread_idx < num_threads; ++thread_idx) {
+            threads.emplace_back([&, thread_idx]() {
+                for (int64 idx = thread_idx; idx < num_group_chunks; idx += num_threads) {
+                    const int64 num_chunk_rows = std::min(chunk_rows, num_rows - (first_chunk + idx) * chunk_rows);
+                    compressed_sizes[idx] = Compression::compress(
+                            codec, level, raw_chunks.data() + idx * raw_chunk_size_b, num_chunk_rows * row_size_b,
+                            compressed_chunks.data() + idx * compress_bound_b, compress_bound_b
+                    );
+                }
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+
+        for (int64 idx = 0; idx < num_group_chunks; ++idx) {
+            write_all(output_descriptor, compressed_chunks.data() + idx * compress_bound_b, compressed_sizes[idx], offset);
+            index[first_chunk + idx] = ChunkIndexEntry{.offset = offset, .compressed_size_b = compressed_sizes[idx]};
+            max_read_size_b = std::max(max_read_size_b, align_up(compressed_sizes[idx], SECTOR_SIZE));
+            offset += align_up(compressed_sizes[idx], SECTOR_SIZE);
+        }
+    }
+
+    // the last chunk is read up to the end of its sector; the gap before the index reads as zeros
+    const int64 index_offset = align_up(offset, PAGE_SIZE);
+    const int64 index_size_b = num_chunks * static_cast<int64>(sizeof(ChunkIndexEntry));
+    write_all(output_descriptor, reinterpret_cast<byte const *>(index.data()), index_size_b, index_offset);
+
+    ContainerHeader header = ContainerHeader{
+            .magic = CompressedContainer::MAGIC,
+            .version = CompressedContainer::VERSION,
+            .codec = codec,
+            .row_size_b = row_size_b,
+            .num_rows = num_rows,
+            .chunk_rows = chunk_rows,
+            .num_chunks = num_chunks,
+            .max_read_size_b = max_read_size_b,
+            .index_offset = index_offset
+    };
+    write_all(output_descriptor, reinterpret_cast<byte const *>(&header), sizeof(header), 0);
+
+    CHECK_SYSCALL(::fsync(output_descriptor) == 0, "fsync() failed: " << output_path);
+    CHECK_SYSCALL(::close(output_descriptor) == 0, "Failed to close file: " << output_path);
+    CHECK_SYSCALL(::close(input_descriptor) == 0, "Failed to close file: " << input_path);
+
+    const double ratio = static_cast<double>(input_stat.st_size) / (index_offset + index_size_b);
+    LOG_VARS("Packed " << input_path << " into " << output_path, num_rows, chunk_rows, num_chunks, max_read_size_b, ratio);
+    return 0;
+}
@@ -2,91 +2,530 @@
 
 #include "utils.h"
 #include "buffers.h"
-#include "blocking_queue.h"
+#include "ring_queue.h"
 #include "batch_block.h"
 #include "worker.h"
 #include "calculator.h"
+#include "stats.h"
+#include "shard.h"
+#include "auto_tuner.h"
+
+#include <atomic>
+#include <mutex>
 
 namespace nvme_sampler {
 
+/**
+ * Position of a sampler in its sequence of batch blocks (see NvmeSampler::get_checkpoint()), stored as plain bytes.
+ *
+ * Contents of a block depend only on the seed and the block's sequence number, so a sampler restored from a checkpoint
+ * fills the blocks from sequence_number on and continues the same sequence of batches without reading anything before it.
+ */
+struct SamplerCheckpoint {
+    static const int64 VERSION = 1;
+    static const int64 MAX_NUM_SHARDS = 64; // every shard has its own worker thread
+
+    int64 version;
+    // the checkpoint can be restored only by a sampler of the same dataset with the same parameters
+    int64 seed;
+    int64 num_rows;
+    int64 num_shards;
+    int64 max_batch_elements;
+    int64 num_batches_in_block;
+    int64 sampling_mode;
+    // position
+    int64 sequence_number; // of the batch block consumers read
+    int64 read_idx; // of the next sample read from the block
+    int64 epoch; // see NvmeSampler::get_epoch()
+    // EpochSamplingMode: positions of ChunkEpochCursors of shards when the block was scheduled; chunks of the epoch read
+    // by older blocks still being filled at that moment are read once more after a restore
+    int64 epoch_positions[MAX_NUM_SHARDS];
+};
+
+/**
+ * Position of a consumer thread: the batch block it claims batches from (it holds one of the block's references).
+ */
+struct ConsumerCursor {
+    BatchBlockPtr block{nullptr};
+    ConsumerCounters counters;
+};
+
 class NvmeSampler {
 
 private:
     const TensorDescription tensor_description;
     const SamplerConfig sampler_config;
     const SamplingParameters sampling_params;
-    const int32 file_descriptor;
+    const std::vector<Shard> shards;
 
     BatchBlocks batch_blocks;
-    BatchBlock *current_block{NULL};
+    std::mutex shared_block_mutex;
+    BatchBlockPtr shared_block{nullptr}; // block consumers currently claim batches from
+    bool shared_block_retired{false}; // its ready event is consumed (see ReadyBlocks::retire())
 
     std::vector<std::shared_ptr<WorkerThread>> workers;
     std::vector<std::thread> worker_threads;
-    WorkQueue work_queue;
+    std::vector<std::unique_ptr<WorkQueue>> work_queues; // one per shard
+    std::vector<std::unique_ptr<PoolConcurrency>> pools; // one per shard
+    std::unique_ptr<AutoTuner> auto_tuner; // nullptr unless SamplerConfig::auto_tune
+    std::vector<std::unique_ptr<ReadBatchBlockTask>> read_tasks; // one per batch block (indexed by BatchBlock::block_idx)
+    std::vector<std::unique_ptr<ChunkEpochCursor>> epoch_cursors; // one per shard in EpochSamplingMode
+    std::atomic<int64> current_epoch{0};
+    std::atomic<int64> num_scheduled_blocks{0}; // sequence number of the next block filling
+    SamplerCheckpoint initial_checkpoint{}; // position before the first block
+    std::vector<SamplerCheckpoint> block_checkpoints; // positions at the start of the blocks (indexed by block_idx)
+
+    mutable std::mutex consumers_mutex;
+    std::vector<std::unique_ptr<ConsumerCursor>> consumers;
+    ConsumerCursor *default_consumer{nullptr}; // consumer 0
+
+    const int64 start_time_ns{monotonic_time_ns()};
+    int64 batch_blocks_page_size_b{0};
+    int64 batch_blocks_locked_b{0};
 
 public:
-    NvmeSampler(TensorDescription const &tensor_description, SamplerConfig const &sampler_config, BatchBlocks::Allocator allocator)
+    // checkpoint: nullptr or a position of a sampler of the same dataset and parameters (see get_checkpoint()) to continue from
+    NvmeSampler(TensorDescription const &tensor_description, SamplerConfig const &sampler_config, BatchBlocks::Allocator allocator,
+                SamplerCheckpoint const *checkpoint = nullptr)
             : tensor_description(tensor_description),
               sampler_config(sampler_config),
-              sampling_params(SamplingParametersCalculator::calculate(tensor_description.get_size(), tensor_description.row_size_b, sampler_config)),
-              file_descriptor(::open(tensor_description.file_path.c_str(), O_DIRECT | O_RDONLY)),
-              batch_blocks(tensor_description.row_size_b, sampling_params.num_batches_in_block * sampler_config.max_batch_elements, allocator) {
+              sampling_params(SamplingParametersCalculator::calculate(tensor_description.get_size(), tensor_description.row_size_b, sampler_config,
+                                                                      Compression::get_chunk_rows(tensor_description, sampler_config))),
+              shards(Shards::open(tensor_description, sampler_config, sampling_params)),
+              batch_blocks(sampling_params.output_row_size_b, sampling_params.num_batches_in_block * sampler_config.max_batch_elements,
+                           sampler_config.num_batch_blocks, allocator) {
+
+        if (sampler_config.numa_policy != NoNumaPolicy) {
+            // batch blocks are read by the consumer: cross-node traffic happens once, when workers write them
+            this->bind_batch_blocks(Numa::get_current_node());
+        }
+        this->prepare_batch_blocks_memory();
 
-        CHECK_SYSCALL(this->file_descriptor >= 0,
-                      "Failed to open file: " << tensor_description.file_path);
+        int32 thread_idx = 0;
+        for (auto const &shard : this->shards) {
+            // every batch block has at most one sub-task per worker in flight
+            this->work_queues.emplace_back(new WorkQueue(shard.num_workers * sampler_config.num_batch_blocks));
+            this->pools.emplace_back(new PoolConcurrency(shard.num_workers, sampler_config.io_queue_depth));
+            if (sampler_config.sampling_mode == EpochSamplingMode) {
+                this->epoch_cursors.emplace_back(new ChunkEpochCursor(shard.num_chunks, sampler_config.seed));
+            }
+            ChunkEpochCursor *epoch_cursor = this->epoch_cursors.empty() ? nullptr : this->epoch_cursors.back().get();
 
-        CHECK_SYSCALL(::posix_fadvise(this->file_descriptor, 0, tensor_description.get_size(), POSIX_FADV_NOREUSE | POSIX_FADV_RANDOM) == 0,
-                      "fadvise() failed");
+            for (int64 pool_thread_idx = 0; pool_thread_idx < shard.num_workers; ++pool_thread_idx, ++thread_idx) {
+                auto worker = std::make_shared<WorkerThread>(
+                        thread_idx, pool_thread_idx, tensor_description, sampler_config, sampling_params, shard, epoch_cursor,
+                        this->work_queues.back().get(), this->pools.back().get()
+                );
+                this->workers.emplace_back(worker);
+                this->worker_threads.emplace_back([worker]() { (*worker)(); });
 
-        for (int thread_idx = 0; thread_idx < this->sampler_config.max_num_threads; ++thread_idx) {
-            auto worker = std::make_shared<WorkerThread>(
-                    thread_idx, tensor_description, sampler_config, sampling_params, file_descriptor, &work_queue
-            );
-            this->workers.emplace_back(worker);
-            this->worker_threads.emplace_back([worker]() { (*worker)(); });
+                if (shard.numa_node != Numa::UNKNOWN_NODE && !Numa::pin_thread(this->worker_threads.back(), shard.numa_node)) {
+                    LOG("Failed to pin worker " << thread_idx << " to NUMA node " << shard.numa_node);
+                }
+            }
         }
 
+        if (this->workers.front()->get_convert_kernel()) {
+            LOG("Workers convert rows into batch blocks with the " << this->workers.front()->get_convert_kernel()->name << " kernel");
+        } else {
+            LOG("Workers copy rows into batch blocks with the " << this->workers.front()->get_copy_kernel().name << " kernel");
+        }
+        if (sampler_config.auto_tune) {
+            this->auto_tuner.reset(this->create_auto_tuner());
+        }
+        this->default_consumer = &this->get_consumer(this->create_consumer());
+        for (auto &block : this->batch_blocks.batch_blocks) {
+            this->read_tasks.emplace_back(this->create_read_task(block.get()));
+        }
+        this->block_checkpoints.resize(this->batch_blocks.batch_blocks.size());
+        this->initial_checkpoint = this->create_checkpoint(0);
+        if (checkpoint) {
+            this->restore(*checkpoint);
+        }
         for (auto &block : this->batch_blocks.batch_blocks) {
             this->schedule_batch_block_reading(block.get());
         }
     }
 
     ~NvmeSampler() {
-        work_queue.invalidate();
+        for (auto &work_queue : this->work_queues) {
+            work_queue->invalidate();
+        }
+        for (auto &pool : this->pools) {
+            pool->close();
+        }
         for (auto &thread : this->worker_threads) {
             thread.join();
         }
 
-        CHECK_SYSCALL(::close(this->file_descriptor) == 0, "Failed to close file a file descriptor");
+        Shards::close(this->shards);
+    }
+
+    // Registers a consumer thread. Every consumer reads batches through its own cursor (get_next_batch(consumer, ...) and
+    // friends), so any number of threads can share workers and batch blocks; a cursor must be used by one thread at a time.
+    // Cursors live as long as the sampler. Consumer 0 is used by the methods without a consumer argument.
+    // A consumer keeps the block it reads from until its next call moves it to another one, so every consumer that stops
+    // reading holds a block out of rotation: use more than num_consumers + 1 batch blocks.
+    int64 create_consumer() {
+        std::lock_guard<std::mutex> lock(this->consumers_mutex);
+        this->consumers.emplace_back(new ConsumerCursor());
+        return static_cast<int64>(this->consumers.size()) - 1;
+    }
+
+    ConsumerCursor &get_consumer(int64 consumer_idx) {
+        std::lock_guard<std::mutex> lock(this->consumers_mutex);
+        CASSERT(consumer_idx >= 0 && consumer_idx < static_cast<int64>(this->consumers.size()), "no consumer %ld", consumer_idx);
+        return *this->consumers[consumer_idx];
+    }
+
+    // Hands the consumer's current block back (a consumer that stops reading would keep it forever); the consumer must not
+    // be used afterwards, its counters stay in statistics.
+    void close_consumer(int64 consumer_idx) {
+        ConsumerCursor &consumer = this->get_consumer(consumer_idx);
+        std::lock_guard<std::mutex> lock(this->shared_block_mutex);
+        if (consumer.block) {
+            this->release_block(consumer.block);
+            consumer.block = nullptr;
+        }
+    }
+
+    // The batch stays valid until the consumer moves to another batch block, i.e. at least until its next call.
+    byte *get_next_batch(ConsumerCursor &consumer, int32 batch_size) {
+        byte *batch = this->try_get_next_batch(consumer, batch_size);
+        if (!batch) {
+            const int64 wait_start_ns = monotonic_time_ns();
+            do {
+                this->batch_blocks.ready_blocks.wait();
+            } while (!(batch = this->try_get_next_batch(consumer, batch_size)));
+            consumer.counters.wait_ns.add(monotonic_time_ns() - wait_start_ns);
+        }
+        return batch;
+    }
+
+    // Like get_next_batch(), but returns nullptr instead of waiting when no batch block is ready (see get_ready_event_fd()).
+    byte *try_get_next_batch(ConsumerCursor &consumer, int32 batch_size) {
+        ASSERT(batch_size < this->batch_blocks.batch_blocks[0]->num_samples, "batch size: %d", batch_size);
+
+        byte *batch = consumer.block ? consumer.block->claim_next_batch(batch_size) : nullptr;
+        while (!batch) {
+            if (!this->move_to_shared_block(consumer, batch_size)) {
+                return nullptr;
+            }
+            batch = consumer.block->claim_next_batch(batch_size);
+        }
+
+        consumer.counters.batches_consumed.add(1);
+        consumer.counters.samples_consumed.add(batch_size);
+        return batch;
+    }
+
+    // Like get_next_batch(), but the batch stays valid until release_batch(): its block is not refilled while any of its
+    // batches is leased. Blocks with leased batches are out of rotation, so keep them fewer than num_batch_blocks - 1.
+    byte *lease_next_batch(ConsumerCursor &consumer, int32 batch_size) {
+        byte *batch = this->get_next_batch(consumer, batch_size);
+        consumer.block->num_references.fetch_add(1, std::memory_order_relaxed);
+        return batch;
+    }
+
+    // Like lease_next_batch(), but returns nullptr instead of waiting when no batch block is ready.
+    byte *try_lease_next_batch(ConsumerCursor &consumer, int32 batch_size) {
+        byte *batch = this->try_get_next_batch(consumer, batch_size);
+        if (batch) {
+            consumer.block->num_references.fetch_add(1, std::memory_order_relaxed);
+        }
+        return batch;
     }
 
     byte *get_next_batch(int32 batch_size) {
-        if (!current_block) {
-            this->fetch_next_batch_block();
+        return this->get_next_batch(*this->default_consumer, batch_size);
+    }
+
+    byte *try_get_next_batch(int32 batch_size) {
+        return this->try_get_next_batch(*this->default_consumer, batch_size);
+    }
+
+    byte *lease_next_batch(int32 batch_size) {
+        return this->lease_next_batch(*this->default_consumer, batch_size);
+    }
+
+    // may be called from any thread
+    void release_batch(byte const *batch) {
+        this->release_block(this->batch_blocks.get_block(batch));
+    }
+
+    // eventfd readable while a filled batch block is waiting or the block shared by consumers may still serve batches
+    // (level-triggered); it becomes readable just before a block is queued, so try_get_next_batch() may need to be
+    // retried right after a wake-up
+    int32 get_ready_event_fd() const {
+        return this->batch_blocks.ready_blocks.get_event_fd();
+    }
+
+    // Called by a worker thread whenever a batch block is filled (nullptr: no callback); it must be short and must not
+    // use the sampler. Returns after the previous callback has finished running.
+    void set_ready_callback(std::function<void()> callback) {
+        this->batch_blocks.ready_blocks.set_callback(std::move(callback));
+    }
+
+    // Epoch of the batches returned recently (always 0 unless EpochSamplingMode is used). Blocks are filled concurrently,
+    // so a block may mix the end of one epoch with the beginning of the next one; the epoch grows when a block made only
+    // of chunks of a newer epoch is fetched.
+    int64 get_epoch() const {
+        return this->current_epoch.load(std::memory_order_relaxed);
+    }
+
+    // Position of the sampler after the batches returned so far, to be passed to a new sampler (e.g. after a restart of
+    // the job). With several consumers it is the position in the block they share; batches a consumer still claims from
+    // an older block are not part of it.
+    SamplerCheckpoint get_checkpoint() {
+        std::lock_guard<std::mutex> lock(this->shared_block_mutex);
+        if (!this->shared_block) {
+            return this->initial_checkpoint;
         }
+        SamplerCheckpoint checkpoint = this->block_checkpoints[this->shared_block->block_idx];
+        checkpoint.read_idx = this->shared_block->read_idx.load(std::memory_order_relaxed);
+        checkpoint.epoch = this->current_epoch.load(std::memory_order_relaxed);
+        return checkpoint;
+    }
 
-        if (current_block->get_num_samples_left() > batch_size) {
-            return current_block->read_next_batch(batch_size);
+    SamplingParameters const &get_sampling_params() const {
+        return this->sampling_params;
+    }
+
+    int64 get_num_workers() const {
+        return static_cast<int64>(this->workers.size());
+    }
+
+    WorkerCounters const &get_worker_counters(int64 worker_idx) const {
+        ASSERT(worker_idx >= 0 && worker_idx < this->get_num_workers(), "%ld", worker_idx);
+        return this->workers[worker_idx]->counters;
+    }
+
+    // workers taking sub-tasks and reads each of them keeps in flight (below max_num_threads and io_queue_depth only if
+    // lowered by the auto-tuner)
+    int64 get_num_active_workers() const {
+        int64 num_active_workers = 0;
+        for (auto const &pool : this->pools) {
+            num_active_workers += pool->get_num_active_workers();
         }
+        return num_active_workers;
+    }
 
-        ASSERT(batch_size < current_block->num_samples, "batch size: %d, num_samples: %ld", batch_size, current_block->num_samples);
+    int32 get_io_queue_depth() const {
+        return this->pools.front()->get_queue_depth();
+    }
 
-        this->schedule_batch_block_reading(current_block);
-        current_block = nullptr;
+    int64 get_num_consumers() const {
+        std::lock_guard<std::mutex> lock(this->consumers_mutex);
+        return static_cast<int64>(this->consumers.size());
+    }
+
+    ConsumerCounters const &get_consumer_counters(int64 consumer_idx) const {
+        std::lock_guard<std::mutex> lock(this->consumers_mutex);
+        ASSERT(consumer_idx >= 0 && consumer_idx < static_cast<int64>(this->consumers.size()), "%ld", consumer_idx);
+        return this->consumers[consumer_idx]->counters;
+    }
 
-        return this->get_next_batch(batch_size);
+    int64 get_elapsed_time_ns() const {
+        return monotonic_time_ns() - this->start_time_ns;
+    }
+
+    MemoryStats get_memory_stats() const {
+        MemoryStats stats{
+                .batch_blocks_page_size_b = this->batch_blocks_page_size_b,
+                .read_buffers_page_size_b = 0,
+                .locked_b = this->batch_blocks_locked_b
+        };
+        for (auto const &worker : this->workers) {
+            const int64 page_size_b = worker->get_read_buffer().get_page_size();
+            if (page_size_b > 0 && (stats.read_buffers_page_size_b == 0 || page_size_b < stats.read_buffers_page_size_b)) {
+                stats.read_buffers_page_size_b = page_size_b;
+            }
+            stats.locked_b += worker->get_read_buffer().get_locked_size();
+        }
+        return stats;
     }
 
 private:
-    void fetch_next_batch_block() {
-        bool success = this->batch_blocks.ready_blocks.pop(current_block);
-        ASSERT(success, "Reading from closed queue");
+    void bind_batch_blocks(int32 numa_node) {
+        for (auto const &block : this->batch_blocks.batch_blocks) {
+            if (!Numa::bind_memory(block->buffer.buffer, block->buffer.size, numa_node)) {
+                LOG("Failed to bind batch blocks to NUMA node " << numa_node << "; errno: " << errno);
+                return;
+            }
+        }
+        LOG("Batch blocks bound to NUMA node " << numa_node);
+    }
+
+    // huge pages and mlock() of batch blocks; called after NUMA binding, as locking faults pages in
+    void prepare_batch_blocks_memory() {
+        Buffer const memory = this->batch_blocks.get_memory();
+        auto const &page_size = this->batch_blocks.allocator.page_size;
+        this->batch_blocks_page_size_b = page_size ? page_size() : Pages::BASE_PAGE_SIZE;
+
+        if (!page_size && this->sampler_config.huge_pages != NoHugePages) {
+            if (this->sampler_config.huge_pages != TransparentHugePages) {
+                LOG("Batch blocks come from a custom allocator and can use only transparent huge pages (see create_page_allocator())");
+            }
+            this->batch_blocks_page_size_b = Pages::advise_transparent(memory.buffer, memory.size, "batch blocks");
+        }
+
+        if (this->sampler_config.lock_memory && Pages::lock(memory.buffer, memory.size, "batch blocks")) {
+            this->batch_blocks_locked_b = memory.size;
+        }
+        if (this->sampler_config.huge_pages != NoHugePages || this->sampler_config.lock_memory) {
+            LOG("Batch blocks use " << this->batch_blocks_page_size_b << "-byte pages; locked: " << this->batch_blocks_locked_b << " bytes");
+        }
+    }
+
+    // Points the consumer at the block shared by all consumers, replacing it with the next ready block if it cannot serve
+    // a batch of batch_size; returns false if a new block is needed but none is ready. Claims of batches are lock-free,
+    // only block switches (once per block and consumer) take the lock.
+    bool move_to_shared_block(ConsumerCursor &consumer, int32 batch_size) {
+        std::lock_guard<std::mutex> lock(this->shared_block_mutex);
+
+        if (!this->shared_block || this->shared_block->get_num_samples_left() <= batch_size) {
+            // the ready event of the shared block keeps waiting consumers awake until it is exhausted, so they do not miss
+            // a block another consumer has just taken from the queue
+            if (this->shared_block && !this->shared_block_retired) {
+                this->batch_blocks.ready_blocks.retire();
+                this->shared_block_retired = true;
+            }
+            BatchBlockPtr block;
+            if (!this->batch_blocks.ready_blocks.try_pop(block)) {
+                return false;
+            }
+            block->num_references.store(1, std::memory_order_relaxed); // the sampler's reference
+            if (this->shared_block) {
+                this->release_block(this->shared_block);
+            }
+            this->shared_block = block;
+            this->shared_block_retired = false;
+            this->current_epoch.store(std::max(this->current_epoch.load(std::memory_order_relaxed), block->epoch), std::memory_order_relaxed);
+            consumer.counters.blocks_consumed.add(1);
+        }
+
+        if (consumer.block != this->shared_block) {
+            this->shared_block->num_references.fetch_add(1, std::memory_order_relaxed);
+            if (consumer.block) {
+                this->release_block(consumer.block);
+            }
+            consumer.block = this->shared_block;
+        }
+        return true;
+    }
+
+    // position at the start of the block with the given sequence number (workers may be reading, epoch positions are a snapshot)
+    SamplerCheckpoint create_checkpoint(int64 sequence_number) const {
+        SamplerCheckpoint checkpoint{
+                .version = SamplerCheckpoint::VERSION,
+                .seed = this->sampler_config.seed,
+                .num_rows = this->tensor_description.num_rows,
+                .num_shards = static_cast<int64>(this->shards.size()),
+                .max_batch_elements = this->sampler_config.max_batch_elements,
+                .num_batches_in_block = this->sampling_params.num_batches_in_block,
+                .sampling_mode = this->sampler_config.sampling_mode,
+                .sequence_number = sequence_number,
+                .read_idx = 0,
+                .epoch = this->current_epoch.load(std::memory_order_relaxed),
+                .epoch_positions = {}
+        };
+        for (size_t shard_idx = 0; shard_idx < this->epoch_cursors.size(); ++shard_idx) {
+            checkpoint.epoch_positions[shard_idx] = this->epoch_cursors[shard_idx]->position.load(std::memory_order_relaxed);
+        }
+        return checkpoint;
+    }
+
+    // called before any block is scheduled
+    void restore(SamplerCheckpoint const &checkpoint) {
+        SamplerCheckpoint const &expected = this->initial_checkpoint;
+        CASSERT(checkpoint.version == SamplerCheckpoint::VERSION, "unsupported checkpoint version: %ld", checkpoint.version);
+        CASSERT(checkpoint.seed == expected.seed && checkpoint.num_rows == expected.num_rows && checkpoint.num_shards == expected.num_shards &&
+                checkpoint.max_batch_elements == expected.max_batch_elements && checkpoint.sampling_mode == expected.sampling_mode,
+                "checkpoint of another dataset or sampler configuration (seed: %ld, num_rows: %ld, num_shards: %ld, "
+                "max_batch_elements: %ld, sampling_mode: %ld)", checkpoint.seed, checkpoint.num_rows, checkpoint.num_shards,
+                checkpoint.max_batch_elements, checkpoint.sampling_mode);
+        CASSERT(checkpoint.num_batches_in_block == expected.num_batches_in_block,
+                "checkpoint was taken with %ld batches in a block, got %ld (memory_usage_limit_b and num_batch_blocks must not change)",
+                checkpoint.num_batches_in_block, expected.num_batches_in_block);
+        CASSERT(checkpoint.sequence_number >= 0 && checkpoint.read_idx >= 0, "corrupted checkpoint");
+
+        this->initial_checkpoint = checkpoint;
+        this->num_scheduled_blocks.store(checkpoint.sequence_number, std::memory_order_relaxed);
+        this->batch_blocks.ready_blocks.start_at(checkpoint.sequence_number);
+        this->current_epoch.store(checkpoint.epoch, std::memory_order_relaxed);
+        for (size_t shard_idx = 0; shard_idx < this->epoch_cursors.size(); ++shard_idx) {
+            this->epoch_cursors[shard_idx]->position.store(checkpoint.epoch_positions[shard_idx], std::memory_order_relaxed);
+        }
+        LOG("Restored sampler position: block " << checkpoint.sequence_number << ", sample " << checkpoint.read_idx);
+    }
+
+    void release_block(BatchBlockPtr block) {
+        const int32 num_references = block->num_references.fetch_sub(1, std::memory_order_acq_rel);
+        ASSERT(num_references > 0, "batch released more times than leased (block %d)", block->block_idx);
+        if (num_references == 1) {
+            this->schedule_batch_block_reading(block);
+        }
+    }
+
+    AutoTuner *create_auto_tuner() const {
+        std::vector<PoolConcurrency *> pools;
+        for (auto const &pool : this->pools) {
+            pools.push_back(pool.get());
+        }
+        std::vector<WorkerCounters const *> worker_counters;
+        for (auto const &worker : this->workers) {
+            worker_counters.push_back(&worker->counters);
+        }
+        return new AutoTuner(pools, worker_counters, this->sampler_config.io_queue_depth);
+    }
+
+    ReadBatchBlockTask *create_read_task(BatchBlockPtr batch_block) {
+        auto task = new ReadBatchBlockTask(batch_block, &this->batch_blocks.ready_blocks);
+
+        // every worker of a shard pool gets a sub-task; columns are assigned whenever the block is scheduled
+        for (int64 shard_idx = 0; shard_idx < static_cast<int64>(this->shards.size()); ++shard_idx) {
+            for (int64 pool_task_idx = 0; pool_task_idx < this->shards[shard_idx].num_workers; ++pool_task_idx) {
+                task->add_sub_task(shard_idx, 0, 0);
+            }
+        }
+        return task;
+    }
+
+    // columns of shards (see Shards::draw_columns()) are split equally between the sub-tasks of their workers
+    void assign_columns(ReadBatchBlockTask &task, int64 sequence_number) {
+        std::vector<int64> shard_columns; // blocks may be scheduled by several threads at once
+        Shards::draw_columns(this->shards, this->sampler_config.seed, sequence_number, this->sampler_config.max_batch_elements,
+                             shard_columns);
+
+        int64 first_column = 0;
+        size_t sub_task_idx = 0;
+        for (int64 shard_idx = 0; shard_idx < static_cast<int64>(this->shards.size()); ++shard_idx) {
+            const int64 num_columns = shard_columns[shard_idx];
+            const int64 num_workers = this->shards[shard_idx].num_workers;
+            for (int64 pool_task_idx = 0; pool_task_idx < num_workers; ++pool_task_idx, ++sub_task_idx) {
+                ReadBatchBlockSubTask &sub_task = task.sub_tasks[sub_task_idx];
+                sub_task.first_column = first_column;
+                sub_task.num_columns = num_columns / num_workers + (pool_task_idx < num_columns % num_workers ? 1 : 0);
+                first_column += sub_task.num_columns;
+            }
+        }
     }
 
     void schedule_batch_block_reading(BatchBlockPtr batch_block) {
-        auto task = std::make_shared<ReadBatchBlockTask>(batch_block, &this->batch_blocks.ready_blocks, this->sampler_config.max_num_threads);
-        for (int32 sub_task_id = 0; sub_task_id < this->sampler_config.max_num_threads; ++sub_task_id) {
-            work_queue.push(std::make_shared<ReadBatchBlockSubTask>(task, sub_task_id));
+        if (this->auto_tuner) {
+            this->auto_tuner->step(); // between blocks: the consumer has just finished one
+        }
+
+        ReadBatchBlockTask &task = *this->read_tasks[batch_block->block_idx];
+        const int64 sequence_number = this->num_scheduled_blocks.fetch_add(1, std::memory_order_relaxed);
+        this->block_checkpoints[batch_block->block_idx] = this->create_checkpoint(sequence_number);
+
+        // the block read at a restored checkpoint continues where it was left
+        const bool restored = sequence_number == this->initial_checkpoint.sequence_number;
+        this->assign_columns(task, sequence_number);
+        task.reset(sequence_number, restored ? this->initial_checkpoint.read_idx : 0);
+        for (auto &sub_task : task.sub_tasks) {
+            this->work_queues[sub_task.shard_idx]->push(&sub_task);
         }
     }
 };
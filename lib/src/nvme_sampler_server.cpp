@@ -0,0 +1,88 @@
+// Local sampler daemon serving batches of one dataset to client processes through shared memory (see sampler_server.h).
+//
+// usage: nvme_sampler_server socket_path file_paths row_size_b num_rows max_batch_elements max_num_threads memory_usage_limit_b
+//                            [num_batch_blocks] [io_engine] [seed] [value_format]
+// file_paths: comma-separated list of shards
+// io_engine: libaio (default), io_uring or io_uring_sqpoll, as in the Python binding
+// value_format: float32 (default), float16, bfloat16 or int8 (with scale 1 and offset 0), as in the Python binding
+
+#include "sampler_server.h"
+
+#include <csignal>
+#include <cstring>
+#include <sstream>
+
+using namespace nvme_sampler;
+
+static SamplerServer *server = nullptr;
+
+static void stop_server(int) {
+    if (server) {
+        server->stop();
+    }
+}
+
+static IoEngineType parse_io_engine(char const *name) {
+    const std::pair<char const *, IoEngineType> io_engines[] = {
+            {"libaio", LibAioEngineType}, {"io_uring", IoUringEngineType}, {"io_uring_sqpoll", IoUringSqPollEngineType}
+    };
+    for (auto const &io_engine : io_engines) {
+        if (std::strcmp(name, io_engine.first) == 0) {
+            return io_engine.second;
+        }
+    }
+    ERROR("Unknown io_engine " << name << " (libaio, io_uring or io_uring_sqpoll)");
+}
+
+static ValueFormatType parse_value_format(char const *name) {
+    const std::pair<char const *, ValueFormatType> value_formats[] = {
+            {"float32", Float32ValueFormat}, {"float16", Float16ValueFormat}, {"bfloat16", BFloat16ValueFormat}, {"int8", Int8ValueFormat}
+    };
+    for (auto const &value_format : value_formats) {
+        if (std::strcmp(name, value_format.first) == 0) {
+            return value_format.second;
+        }
+    }
+    ERROR("Unknown value_format " << name << " (float32, float16, bfloat16 or int8)");
+}
+
+int main(int argc, char **argv) {
+    if (argc < 8 || argc > 12) {
+        fprintf(stderr, "usage: %s socket_path file_paths row_size_b num_rows max_batch_elements max_num_threads memory_usage_limit_b "
+                        "[num_batch_blocks] [io_engine] [seed] [value_format]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<std::string> file_paths;
+    std::stringstream file_paths_stream(argv[2]);
+    for (std::string file_path; std::getline(file_paths_stream, file_path, ',');) {
+        file_paths.push_back(file_path);
+    }
+
+    TensorDescription tensor_description = {
+            .num_rows = std::atol(argv[4]),
+            .row_size_b = std::atol(argv[3]),
+            .file_paths = file_paths
+    };
+
+    // every client pins the block it reads and the blocks of its prefetched batches, so use plenty of small blocks
+    SamplerConfig config = {
+            .max_batch_elements = std::atol(argv[5]),
+            .max_num_threads = std::atol(argv[6]),
+            .memory_usage_limit_b = std::atol(argv[7]),
+            .seed = argc > 10 ? std::atoi(argv[10]) : static_cast<int32>(monotonic_time_ns()),
+            .io_engine = argc > 9 ? parse_io_engine(argv[9]) : LibAioEngineType,
+            .num_batch_blocks = argc > 8 ? std::atoi(argv[8]) : 16,
+            .value_format = argc > 11 ? parse_value_format(argv[11]) : Float32ValueFormat
+    };
+
+    SamplerServer sampler_server(argv[1], tensor_description, config);
+    server = &sampler_server;
+    std::signal(SIGINT, stop_server);
+    std::signal(SIGTERM, stop_server);
+
+    sampler_server.run();
+    server = nullptr;
+    LOG("Sampler server stopped");
+    return 0;
+}
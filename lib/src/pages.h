@@ -0,0 +1,144 @@
+#pragma once
+
+#include "utils.h"
+#include "buffers.h"
+#include "calculator.h"
+
+#include <sys/mman.h>
+#include <cerrno>
+#include <utility>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+namespace nvme_sampler {
+namespace Pages {
+
+static const int64 BASE_PAGE_SIZE = SamplingParametersCalculator::PAGE_SIZE;
+static const int64 HUGE_PAGE_2M_SIZE = 1L << 21;
+static const int64 HUGE_PAGE_1G_SIZE = 1L << 30;
+
+inline int64 get_huge_tlb_page_size(HugePagesPolicyType huge_pages) {
+    return huge_pages == HugeTlb1GPages ? HUGE_PAGE_1G_SIZE : HUGE_PAGE_2M_SIZE;
+}
+
+// Asks the kernel to back [address, address + size) with transparent huge pages; returns the page size it asked for.
+inline int64 advise_transparent(byte *address, int64 size, char const *name) {
+    byte *const begin = align_up_ptr(address, HUGE_PAGE_2M_SIZE);
+    const int64 length = align_down(size - (begin - address), HUGE_PAGE_2M_SIZE);
+    if (length <= 0) {
+        return BASE_PAGE_SIZE; // smaller than a huge page
+    }
+    if (::madvise(begin, length, MADV_HUGEPAGE) != 0) {
+        LOG("Transparent huge pages are unavailable for " << name << " (errno: " << errno << "), using 4 KiB pages");
+        return BASE_PAGE_SIZE;
+    }
+    return HUGE_PAGE_2M_SIZE;
+}
+
+// Locks pages in RAM (faulting them in); returns false (and reports it) if RLIMIT_MEMLOCK is too low.
+inline bool lock(byte *address, int64 size, char const *name) {
+    if (::mlock(address, size) != 0) {
+        LOG("Failed to mlock() " << size << " bytes of " << name << " (errno: " << errno << "), check RLIMIT_MEMLOCK");
+        return false;
+    }
+    return true;
+}
+
+}
+
+/**
+ * Anonymous memory mapping backed by pages chosen by HugePagesPolicyType.
+ *
+ * HugeTLB pages come from the hugetlbfs pool (vm.nr_hugepages); if the pool is empty the mapping falls back to smaller
+ * pages: 1 GiB -> 2 MiB -> transparent huge pages -> 4 KiB, logging every step. Pages are not touched until first use,
+ * so the buffer can still be bound to a NUMA node.
+ */
+class PageBuffer {
+    byte *address{nullptr};
+    int64 mapped_size{0};
+    int64 page_size_b{0};
+    bool locked{false};
+
+public:
+    PageBuffer() = default;
+
+    PageBuffer(int64 size, HugePagesPolicyType huge_pages, char const *name) {
+        if (size <= 0) {
+            return;
+        }
+
+        for (HugePagesPolicyType policy = huge_pages; policy >= HugeTlb2MPages; policy = static_cast<HugePagesPolicyType>(policy - 1)) {
+            const int64 huge_page_size = Pages::get_huge_tlb_page_size(policy);
+            const int32 size_flag = (policy == HugeTlb1GPages ? 30 : 21) << MAP_HUGE_SHIFT;
+            const int64 mapped_size = align_up(size, huge_page_size);
+            void *address = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+            if (address != MAP_FAILED) {
+                this->address = static_cast<byte *>(address);
+                this->mapped_size = mapped_size;
+                this->page_size_b = huge_page_size;
+                return;
+            }
+            LOG("Cannot map " << mapped_size << " bytes of " << name << " with " << (huge_page_size >> 20) << " MiB HugeTLB pages (errno: "
+                              << errno << "), falling back to smaller pages");
+        }
+
+        // 2 MiB alignment lets transparent huge pages cover the whole buffer
+        const int64 alignment = huge_pages == NoHugePages ? Pages::BASE_PAGE_SIZE : Pages::HUGE_PAGE_2M_SIZE;
+        this->mapped_size = align_up(size, Pages::BASE_PAGE_SIZE) + alignment;
+        void *address = ::mmap(nullptr, this->mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        CHECK_SYSCALL(address != MAP_FAILED, "mmap() of " << name << " failed");
+        this->address = static_cast<byte *>(address);
+        this->page_size_b = huge_pages == NoHugePages ? Pages::BASE_PAGE_SIZE
+                                                      : Pages::advise_transparent(this->address, this->mapped_size, name);
+    }
+
+    PageBuffer(PageBuffer const &) = delete;
+
+    PageBuffer &operator=(PageBuffer const &) = delete;
+
+    PageBuffer(PageBuffer &&other) {
+        this->swap(other);
+    }
+
+    PageBuffer &operator=(PageBuffer &&other) {
+        PageBuffer tmp(std::move(other));
+        this->swap(tmp);
+        return *this;
+    }
+
+    ~PageBuffer() {
+        if (this->address) {
+            ::munmap(this->address, this->mapped_size);
+        }
+    }
+
+    void swap(PageBuffer &other) {
+        std::swap(this->address, other.address);
+        std::swap(this->mapped_size, other.mapped_size);
+        std::swap(this->page_size_b, other.page_size_b);
+        std::swap(this->locked, other.locked);
+    }
+
+    // call after NUMA binding: locking faults all pages in
+    bool lock(char const *name) {
+        this->locked = this->address && Pages::lock(this->address, this->mapped_size, name);
+        return this->locked;
+    }
+
+    // transparent huge page buffers start at a 2 MiB boundary
+    byte *get() const {
+        return this->page_size_b == Pages::HUGE_PAGE_2M_SIZE ? align_up_ptr(this->address, Pages::HUGE_PAGE_2M_SIZE) : this->address;
+    }
+
+    int64 get_page_size() const {
+        return this->page_size_b;
+    }
+
+    int64 get_locked_size() const {
+        return this->locked ? this->mapped_size : 0;
+    }
+};
+
+}
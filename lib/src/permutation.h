@@ -0,0 +1,78 @@
+#pragma once
+
+#include "utils.h"
+
+#include <utility>
+
+namespace nvme_sampler {
+
+// splitmix64 finalizer: cheap 64-bit mixing function
+inline uint64 mix64(uint64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+/**
+ * Stateless pseudo-random bijection of [0, size) (needs O(1) memory for any size).
+ *
+ * A Feistel network permutes [0, 2^num_bits), the smallest such range containing size. With an odd num_bits the halves
+ * differ by a bit and swap their widths every round (alternating Feistel), so power-of-two sizes never fall outside of the
+ * range; other indices falling outside of [0, size) are encrypted again (cycle walking), fewer than 2 times on average.
+ * The index-th element is computed directly, so moving forward by any number of elements is O(1).
+ */
+class FeistelPermutation {
+    static const int32 NUM_ROUNDS = 4;
+
+    int64 size;
+    int32 num_bits;
+    uint64 round_keys[NUM_ROUNDS];
+
+public:
+    FeistelPermutation() : FeistelPermutation(1, 0) {}
+
+    FeistelPermutation(int64 size, uint64 key) : size(size), num_bits(1) {
+        ASSERT(size > 0 && size <= (1LL << 62), "%ld", size);
+        while ((1LL << this->num_bits) < size) {
+            ++this->num_bits;
+        }
+
+        for (int32 round = 0; round < NUM_ROUNDS; ++round) {
+            key = mix64(key + 0x9e3779b97f4a7c15ULL);
+            this->round_keys[round] = key;
+        }
+    }
+
+    int64 get_size() const {
+        return this->size;
+    }
+
+    // index-th element of the permutation
+    int64 operator()(int64 index) const {
+        DASSERT(index >= 0 && index < this->size, "index: %ld; size: %ld", index, this->size);
+        uint64 value = static_cast<uint64>(index);
+        do {
+            value = this->encrypt(value);
+        } while (value >= static_cast<uint64>(this->size));
+        return static_cast<int64>(value);
+    }
+
+private:
+    // every round: (high, low) -> (low, high ^ F(low)), where the new low half has the width of the old high half
+    uint64 encrypt(uint64 value) const {
+        int32 high_bits = this->num_bits / 2;
+        int32 low_bits = this->num_bits - high_bits;
+        for (int32 round = 0; round < NUM_ROUNDS; ++round) {
+            const uint64 high = value >> low_bits;
+            const uint64 low = value & ((1ULL << low_bits) - 1);
+            value = (low << high_bits) | (high ^ (mix64(low ^ this->round_keys[round]) & ((1ULL << high_bits) - 1)));
+            std::swap(high_bits, low_bits);
+        }
+        return value;
+    }
+};
+
+}
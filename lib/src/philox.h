@@ -0,0 +1,81 @@
+#pragma once
+
+#include "utils.h"
+
+namespace nvme_sampler {
+
+/**
+ * Philox4x32-10 counter-based generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3").
+ *
+ * A block of random numbers is a pure function of a 128-bit counter and a 64-bit key: any value of a stream can be computed
+ * without the ones before it and streams need no state shared between threads.
+ */
+namespace Philox {
+
+static const uint32_t MULTIPLIER_0 = 0xd2511f53;
+static const uint32_t MULTIPLIER_1 = 0xcd9e8d57;
+static const uint32_t KEY_STEP_0 = 0x9e3779b9;
+static const uint32_t KEY_STEP_1 = 0xbb67ae85;
+static const int32 NUM_ROUNDS = 10;
+
+struct Block {
+    uint32_t words[4];
+};
+
+inline Block generate(Block counter, uint32_t key_0, uint32_t key_1) {
+    for (int32 round = 0; round < NUM_ROUNDS; ++round) {
+        const uint64 product_0 = static_cast<uint64>(MULTIPLIER_0) * counter.words[0];
+        const uint64 product_1 = static_cast<uint64>(MULTIPLIER_1) * counter.words[2];
+        counter = Block{.words = {
+                static_cast<uint32_t>(product_1 >> 32) ^ counter.words[1] ^ key_0,
+                static_cast<uint32_t>(product_1),
+                static_cast<uint32_t>(product_0 >> 32) ^ counter.words[3] ^ key_1,
+                static_cast<uint32_t>(product_0)
+        }};
+        key_0 += KEY_STEP_0;
+        key_1 += KEY_STEP_1;
+    }
+    return counter;
+}
+
+}
+
+/**
+ * Stream of random 64-bit values identified by (seed, stream_idx, sequence_number): the key holds the seed and stream_idx,
+ * the upper half of the counter holds sequence_number and the lower half counts generated blocks.
+ */
+class PhiloxStream {
+    uint32_t key_0;
+    uint32_t key_1;
+    uint64 sequence_number;
+    uint64 block_idx{0};
+    Philox::Block block{};
+    int32 next_word{4}; // in block; 4: the next block has to be generated
+
+public:
+    typedef uint64 result_type;
+
+    PhiloxStream(int32 seed, int64 stream_idx, int64 sequence_number)
+            : key_0(static_cast<uint32_t>(seed)),
+              key_1(static_cast<uint32_t>(stream_idx)),
+              sequence_number(static_cast<uint64>(sequence_number)) {}
+
+    uint64 operator()() {
+        if (this->next_word == 4) {
+            const Philox::Block counter{.words = {
+                    static_cast<uint32_t>(this->block_idx),
+                    static_cast<uint32_t>(this->block_idx >> 32),
+                    static_cast<uint32_t>(this->sequence_number),
+                    static_cast<uint32_t>(this->sequence_number >> 32)
+            }};
+            this->block = Philox::generate(counter, this->key_0, this->key_1);
+            ++this->block_idx;
+            this->next_word = 0;
+        }
+        const uint64 value = (static_cast<uint64>(this->block.words[this->next_word]) << 32) | this->block.words[this->next_word + 1];
+        this->next_word += 2;
+        return value;
+    }
+};
+
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "utils.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <utility>
+
+namespace nvme_sampler {
+
+/**
+ * Bounded lock-free multi-producer multi-consumer queue (Vyukov's ring of sequenced cells) with futex wakeups.
+ *
+ * Producers never block: the capacity must cover every element that can be in flight (pushing into a full queue aborts).
+ * Consumers spin briefly and then sleep on a futex; producers issue a wake-up syscall only if a consumer is asleep.
+ */
+template<typename T>
+class RingQueue {
+    static const int32 SPIN_ITERATIONS = 128;
+
+    struct alignas(64) Cell {
+        std::atomic<uint64> sequence;
+        T value;
+    };
+
+    const uint64 mask;
+    scoped_array<Cell> cells;
+
+    alignas(64) std::atomic<uint64> enqueue_position{0};
+    alignas(64) std::atomic<uint64> dequeue_position{0};
+
+    // event count: bumped by every push (and invalidate), consumers sleep until it changes
+    alignas(64) std::atomic<uint32_t> futex_word{0};
+    std::atomic<int32> num_sleeping{0};
+    std::atomic_bool valid{true};
+
+public:
+    explicit RingQueue(int64 capacity)
+            : mask(static_cast<uint64>(round_up_to_pow2(static_cast<int32>(std::max(capacity, 2L)))) - 1),
+              cells(new Cell[mask + 1]) {
+        for (uint64 idx = 0; idx <= mask; ++idx) {
+            this->cells[idx].sequence.store(idx, std::memory_order_relaxed);
+        }
+    }
+
+    RingQueue(RingQueue const &) = delete;
+
+    RingQueue &operator=(RingQueue const &) = delete;
+
+    ~RingQueue() {
+        invalidate();
+    }
+
+    // returns false once the queue is invalidated
+    bool pop(T &out) {
+        for (;;) {
+            for (int32 spin_idx = 0; spin_idx < SPIN_ITERATIONS; ++spin_idx) {
+                if (this->try_pop(out)) {
+                    return true;
+                }
+                if (!this->valid.load(std::memory_order_acquire)) {
+                    return false;
+                }
+            }
+
+            const uint32_t event = this->futex_word.load(std::memory_order_seq_cst);
+            this->num_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            if (this->try_pop(out)) {
+                this->num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+            if (this->valid.load(std::memory_order_seq_cst)) {
+                futex(FUTEX_WAIT_PRIVATE, event); // returns at once if a push happened after event was read
+            }
+            this->num_sleeping.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    void push(T value) {
+        const bool pushed = this->try_push(std::move(value));
+        CASSERT(pushed, "RingQueue overflow (capacity: %ld)", static_cast<int64>(this->mask + 1));
+        this->futex_word.fetch_add(1, std::memory_order_seq_cst);
+        if (this->num_sleeping.load(std::memory_order_seq_cst) > 0) {
+            futex(FUTEX_WAKE_PRIVATE, 1);
+        }
+    }
+
+    void invalidate() {
+        this->valid.store(false, std::memory_order_seq_cst);
+        this->futex_word.fetch_add(1, std::memory_order_seq_cst);
+        futex(FUTEX_WAKE_PRIVATE, INT_MAX);
+    }
+
+    bool try_push(T value) {
+        uint64 position = this->enqueue_position.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &this->cells[position & this->mask];
+            const int64 diff = static_cast<int64>(cell->sequence.load(std::memory_order_acquire)) - static_cast<int64>(position);
+            if (diff == 0) {
+                if (this->enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // full
+            } else {
+                position = this->enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &out) {
+        uint64 position = this->dequeue_position.load(std::memory_order_relaxed);
+        Cell *cell;
+        for (;;) {
+            cell = &this->cells[position & this->mask];
+            const int64 diff = static_cast<int64>(cell->sequence.load(std::memory_order_acquire)) - static_cast<int64>(position + 1);
+            if (diff == 0) {
+                if (this->dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false; // empty
+            } else {
+                position = this->dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        out = std::move(cell->value);
+        cell->sequence.store(position + this->mask + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    void futex(int32 operation, uint32_t value) {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&this->futex_word), operation, value, nullptr, nullptr, 0);
+    }
+};
+
+}
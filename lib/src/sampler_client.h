@@ -0,0 +1,101 @@
+#pragma once
+
+#include "utils.h"
+#include "shm_channel.h"
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <memory>
+#include <string>
+
+namespace nvme_sampler {
+
+/**
+ * Client of SamplerServer: reads batches from the server's batch blocks mapped into this process (no copy, no I/O and
+ * no worker threads on the client side).
+ */
+class SamplerClient {
+    static const int64 DISCONNECT_CHECK_INTERVAL_NS = 100 * 1000 * 1000;
+
+    const int64 batch_size;
+    int32 socket{-1};
+    ConnectReply reply{};
+    std::unique_ptr<SharedMemory> data_memory;
+    std::unique_ptr<SharedMemory> channel_memory;
+    ClientChannel *channel{nullptr};
+    int64 current_offset{-1}; // of the batch returned last, released by the next get_next_batch()
+
+public:
+    SamplerClient(std::string const &socket_path, int64 batch_size, int64 prefetch_batches) : batch_size(batch_size) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        CASSERT(socket_path.size() < sizeof(address.sun_path), "socket path is too long: %s", socket_path.c_str());
+        std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+        this->socket = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        CHECK_SYSCALL(this->socket >= 0, "socket() failed");
+        CHECK_SYSCALL(::connect(this->socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0,
+                      "Failed to connect to sampler server: " << socket_path);
+
+        const ConnectRequest request{
+                .version = ShmChannel::PROTOCOL_VERSION,
+                .batch_size = batch_size,
+                .prefetch_batches = prefetch_batches
+        };
+        int32 fds[ShmChannel::NUM_PASSED_FDS];
+        const bool sent = ShmChannel::send_message(this->socket, request, nullptr, 0);
+        const bool connected = sent && ShmChannel::receive_message(this->socket, &this->reply, fds, ShmChannel::NUM_PASSED_FDS);
+        CASSERT(connected && this->reply.version == ShmChannel::PROTOCOL_VERSION,
+                "sampler server at %s rejected the client (batch_size: %ld, prefetch_batches: %ld)", socket_path.c_str(), batch_size,
+                prefetch_batches);
+
+        this->data_memory.reset(new SharedMemory(fds[0], this->reply.data_size_b, PROT_READ));
+        this->channel_memory.reset(new SharedMemory(fds[1], sizeof(ClientChannel), PROT_READ | PROT_WRITE));
+        this->channel = this->channel_memory->get_as<ClientChannel>();
+    }
+
+    SamplerClient(SamplerClient const &) = delete;
+
+    SamplerClient &operator=(SamplerClient const &) = delete;
+
+    ~SamplerClient() {
+        this->channel->releases.close();
+        ::close(this->socket);
+    }
+
+    // The batch (batch_size rows of get_row_size_b() bytes) stays valid until the next call; nullptr if the server is gone.
+    byte *get_next_batch() {
+        if (this->current_offset >= 0) {
+            this->channel->releases.push(this->current_offset); // never full: at most prefetch_batches are leased
+            this->current_offset = -1;
+        }
+
+        int64 offset;
+        while (!this->channel->batches.pop(offset, DISCONNECT_CHECK_INTERVAL_NS)) {
+            pollfd poll_fd = {.fd = this->socket, .events = POLLRDHUP, .revents = 0};
+            if (this->channel->batches.closed.load() || ::poll(&poll_fd, 1, 0) != 0) {
+                return nullptr;
+            }
+        }
+        this->current_offset = offset;
+        return this->data_memory->get() + offset;
+    }
+
+    int64 get_batch_size() const {
+        return this->batch_size;
+    }
+
+    int64 get_row_size_b() const {
+        return this->reply.row_size_b;
+    }
+
+    // batches are at offsets of this memory (e.g. to map it once more, read-only: other clients read the same batches)
+    SharedMemory const &get_data_memory() const {
+        return *this->data_memory;
+    }
+};
+
+}
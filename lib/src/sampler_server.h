@@ -0,0 +1,230 @@
+#pragma once
+
+#include "utils.h"
+#include "nvme_sampler.h"
+#include "shm_channel.h"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace nvme_sampler {
+
+// Batch blocks in shared memory (memfd) that clients of SamplerServer map; memory->get() is the allocated buffer.
+inline BatchBlocks::Allocator create_shared_memory_allocator(std::shared_ptr<std::unique_ptr<SharedMemory>> memory) {
+    return {
+            .allocator = [memory](size_t size) {
+                memory->reset(new SharedMemory("nvme_sampler batch blocks", size));
+                return (*memory)->get();
+            },
+            .deleter = [memory](byte *) { memory->reset(); }
+    };
+};
+
+/**
+ * Local sampler daemon: a single NvmeSampler (one set of worker threads, I/O contexts and batch blocks) serving batches
+ * of a dataset to any number of client processes (see SamplerClient).
+ *
+ * Clients connect over a unix socket and get descriptors of the batch blocks memory and of their ClientChannel. Every
+ * client is a consumer of the sampler: its session thread keeps prefetch_batches batches leased for it and passes their
+ * offsets through the channel; batches come back when the client is done with them. Clients share batch blocks and the
+ * I/O of all jobs goes through one worker pool, so memory use does not grow with the number of jobs.
+ */
+class SamplerServer {
+    static const int64 DISCONNECT_CHECK_INTERVAL_NS = 100 * 1000 * 1000;
+    // releases may let blocks held by leases be refilled, so a session waiting for a batch block checks them often
+    static const int32 RELEASE_CHECK_INTERVAL_MS = 1;
+
+    struct ClientSession {
+        std::thread thread;
+        std::atomic_bool finished{false};
+    };
+
+    const std::string socket_path;
+    std::shared_ptr<std::unique_ptr<SharedMemory>> data_memory{std::make_shared<std::unique_ptr<SharedMemory>>()};
+    NvmeSampler sampler;
+    int32 listen_socket{-1};
+    std::atomic_bool running{true};
+    std::list<std::unique_ptr<ClientSession>> sessions;
+
+public:
+    SamplerServer(std::string const &socket_path, TensorDescription const &tensor_description, SamplerConfig const &sampler_config)
+            : socket_path(socket_path),
+              sampler(tensor_description, sampler_config, create_shared_memory_allocator(data_memory)) {
+
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        CASSERT(socket_path.size() < sizeof(address.sun_path), "socket path is too long: %s", socket_path.c_str());
+        std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+        this->listen_socket = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+        CHECK_SYSCALL(this->listen_socket >= 0, "socket() failed");
+        ::unlink(socket_path.c_str());
+        CHECK_SYSCALL(::bind(this->listen_socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0, "bind() failed: " << socket_path);
+        CHECK_SYSCALL(::listen(this->listen_socket, 64) == 0, "listen() failed: " << socket_path);
+        LOG("Sampler server listening on " << socket_path);
+    }
+
+    SamplerServer(SamplerServer const &) = delete;
+
+    SamplerServer &operator=(SamplerServer const &) = delete;
+
+    ~SamplerServer() {
+        this->stop();
+        for (auto &session : this->sessions) {
+            session->thread.join();
+        }
+        ::close(this->listen_socket);
+        ::unlink(this->socket_path.c_str());
+    }
+
+    // accepts clients until stop()
+    void run() {
+        while (this->running.load()) {
+            const int32 client_socket = ::accept4(this->listen_socket, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client_socket < 0) {
+                CHECK_SYSCALL(errno == EINTR || errno == ECONNABORTED || !this->running.load(), "accept() failed");
+                continue;
+            }
+
+            this->join_finished_sessions();
+            this->sessions.emplace_back(new ClientSession());
+            ClientSession *session = this->sessions.back().get();
+            session->thread = std::thread([this, session, client_socket]() {
+                this->serve_client(client_socket);
+                session->finished.store(true);
+            });
+        }
+    }
+
+    // may be called from a signal handler
+    void stop() {
+        this->running.store(false);
+        ::shutdown(this->listen_socket, SHUT_RDWR);
+    }
+
+    NvmeSampler const &get_sampler() const {
+        return this->sampler;
+    }
+
+private:
+    void join_finished_sessions() {
+        for (auto it = this->sessions.begin(); it != this->sessions.end();) {
+            if ((*it)->finished.load()) {
+                (*it)->thread.join();
+                it = this->sessions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void serve_client(int32 client_socket) {
+        SamplingParameters const &sampling_params = this->sampler.get_sampling_params();
+        const int64 max_batch_size = sampling_params.batch_size_b / sampling_params.output_row_size_b;
+
+        ConnectRequest request{};
+        if (!ShmChannel::receive_message(client_socket, &request, nullptr, 0) || request.version != ShmChannel::PROTOCOL_VERSION ||
+            request.batch_size <= 0 || request.batch_size > max_batch_size ||
+            request.prefetch_batches <= 0 || request.prefetch_batches >= ShmRing::CAPACITY) {
+            LOG("Rejected client: version " << request.version << ", batch_size " << request.batch_size << ", prefetch_batches "
+                                            << request.prefetch_batches);
+            ::close(client_socket);
+            return;
+        }
+
+        SharedMemory const &data_memory = **this->data_memory;
+        SharedMemory channel_memory("nvme_sampler client channel", sizeof(ClientChannel));
+        ClientChannel *channel = channel_memory.get_as<ClientChannel>();
+
+        const ConnectReply reply{
+                .version = ShmChannel::PROTOCOL_VERSION,
+                .row_size_b = sampling_params.output_row_size_b,
+                .data_size_b = data_memory.get_size()
+        };
+        const int32 fds[ShmChannel::NUM_PASSED_FDS] = {data_memory.get_file_descriptor(), channel_memory.get_file_descriptor()};
+        if (!ShmChannel::send_message(client_socket, reply, fds, ShmChannel::NUM_PASSED_FDS)) {
+            ::close(client_socket);
+            return;
+        }
+
+        const int64 consumer_idx = this->sampler.create_consumer();
+        ConsumerCursor &consumer = this->sampler.get_consumer(consumer_idx);
+        LOG("Client " << consumer_idx << " connected: batch_size " << request.batch_size << ", prefetch_batches " << request.prefetch_batches);
+
+        // leases never block, so releases, a disconnect and stop() are noticed while no batch block is ready
+        std::vector<int64> leased_offsets;
+        while (this->running.load()) {
+            while (static_cast<int64>(leased_offsets.size()) < request.prefetch_batches) {
+                byte *batch = this->sampler.try_lease_next_batch(consumer, static_cast<int32>(request.batch_size));
+                if (!batch) {
+                    break;
+                }
+                leased_offsets.push_back(batch - data_memory.get());
+                channel->batches.push(leased_offsets.back()); // never full: prefetch_batches < CAPACITY
+            }
+
+            int64 offset;
+            bool released;
+            if (static_cast<int64>(leased_offsets.size()) < request.prefetch_batches) {
+                released = channel->releases.try_pop(offset);
+                if (!released && this->wait_for_batches(consumer, client_socket)) {
+                    break;
+                }
+            } else {
+                released = channel->releases.pop(offset, DISCONNECT_CHECK_INTERVAL_NS);
+                if (!released && is_disconnected(client_socket)) {
+                    break;
+                }
+            }
+
+            if (released) {
+                auto leased = std::find(leased_offsets.begin(), leased_offsets.end(), offset);
+                if (leased == leased_offsets.end()) {
+                    LOG("Client " << consumer_idx << " released a batch it does not hold: " << offset);
+                    break;
+                }
+                leased_offsets.erase(leased);
+                this->sampler.release_batch(data_memory.get() + offset);
+            }
+        }
+
+        channel->batches.close();
+        for (int64 offset : leased_offsets) {
+            this->sampler.release_batch(data_memory.get() + offset);
+        }
+        this->sampler.close_consumer(consumer_idx);
+        ::close(client_socket);
+        LOG("Client " << consumer_idx << " disconnected");
+    }
+
+    // Sleeps until a batch block may be ready, the client disconnects or RELEASE_CHECK_INTERVAL_MS passes; returns true
+    // if the client is disconnected.
+    bool wait_for_batches(ConsumerCursor &consumer, int32 client_socket) {
+        pollfd poll_fds[2] = {
+                {.fd = this->sampler.get_ready_event_fd(), .events = POLLIN, .revents = 0},
+                {.fd = client_socket, .events = POLLRDHUP, .revents = 0}
+        };
+        const int64 wait_start_ns = monotonic_time_ns();
+        const int32 result = ::poll(poll_fds, 2, RELEASE_CHECK_INTERVAL_MS);
+        CHECK_SYSCALL(result >= 0 || errno == EINTR, "poll() failed");
+        consumer.counters.wait_ns.add(monotonic_time_ns() - wait_start_ns);
+        return result > 0 && poll_fds[1].revents != 0;
+    }
+
+    static bool is_disconnected(int32 socket) {
+        pollfd poll_fd = {.fd = socket, .events = POLLRDHUP, .revents = 0};
+        return ::poll(&poll_fd, 1, 0) != 0;
+    }
+};
+
+}
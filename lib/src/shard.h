@@ -0,0 +1,228 @@
+#pragma once
+
+#include "utils.h"
+#include "philox.h"
+#include "calculator.h"
+#include "numa_policy.h"
+#include "alias_table.h"
+#include "compression.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace nvme_sampler {
+
+// RAID-0 layout of the device holding a shard: stripe_size_b bytes go to each of num_devices members in turn
+struct StripeGeometry {
+    int64 stripe_size_b;
+    int32 num_devices;
+};
+
+/**
+ * A file holding a consecutive range of dataset rows (usually one file per NVMe namespace).
+ *
+ * Every shard has its own pool of worker threads. Columns of batches are drawn from shards in proportion to their weight
+ * (the number of their chunks unless sampling is weighted, see draw_columns()), so chunks of all shards are sampled with
+ * the same probability.
+ */
+struct Shard {
+    std::string file_path;
+    int64 first_row; // global index of the first row of the shard
+    int64 num_rows;
+    int64 num_chunks;
+    double weight;
+    std::shared_ptr<AliasTable> alias_table; // chunk distribution in weighted sampling mode, nullptr otherwise
+    std::shared_ptr<CompressedContainer> container; // chunk index of a compressed shard, nullptr for raw files
+    int32 file_descriptor;
+    int64 num_workers;
+    int32 numa_node; // node of the drive (Numa::UNKNOWN_NODE if unknown or NUMA policy is disabled)
+    StripeGeometry stripe; // {0, 0} unless reads are submitted in StripeSubmissionOrder to a known RAID-0 array
+};
+
+namespace Shards {
+
+inline int64 get_file_size(int32 file_descriptor, std::string const &file_path) {
+    struct stat file_stat;
+    CHECK_SYSCALL(::fstat(file_descriptor, &file_stat) == 0, "fstat() failed: " << file_path);
+    return file_stat.st_size;
+}
+
+// Geometry of the md RAID-0 array holding the file ({0, 0} if it is on another device). The file system maps file offsets
+// to the array, so stripes of the file match stripes of the array only for stripe-aligned extents (e.g. XFS with sunit).
+inline StripeGeometry get_file_stripe_geometry(int32 file_descriptor) {
+    struct stat file_stat;
+    if (::fstat(file_descriptor, &file_stat) != 0) {
+        return StripeGeometry{.stripe_size_b = 0, .num_devices = 0};
+    }
+
+    std::stringstream sysfs_path;
+    sysfs_path << "/sys/dev/block/" << major(file_stat.st_dev) << ":" << minor(file_stat.st_dev);
+    std::string device_dir = Numa::resolve_path(sysfs_path.str());
+    if (!device_dir.empty() && Numa::path_exists(device_dir + "/partition")) {
+        device_dir = Numa::resolve_path(device_dir + "/..");
+    }
+
+    std::string level;
+    std::ifstream(device_dir + "/md/level") >> level;
+    int32 chunk_size_b, raid_disks;
+    if (level != "raid0" || !Numa::read_sysfs_int(device_dir + "/md/chunk_size", chunk_size_b) ||
+        !Numa::read_sysfs_int(device_dir + "/md/raid_disks", raid_disks)) {
+        return StripeGeometry{.stripe_size_b = 0, .num_devices = 0};
+    }
+    return StripeGeometry{.stripe_size_b = chunk_size_b, .num_devices = raid_disks};
+}
+
+// stream of draw_columns(); column streams (see ColumnCursor) use indices from 0 to max_batch_elements - 1
+static const int64 COLUMN_SHARDS_STREAM_IDX = -1;
+
+// Number of columns of the block with the given sequence number read from every shard (columns of a shard are contiguous,
+// in shard order). Every column draws its shard from a random stream of the block with probability proportional to its
+// weight, so chunks of all shards are sampled at the same rate whatever the ratio of shard sizes to max_batch_elements.
+inline void draw_columns(std::vector<Shard> const &shards, int32 seed, int64 sequence_number, int64 max_batch_elements,
+                         std::vector<int64> &num_columns) {
+    num_columns.assign(shards.size(), 0);
+    if (shards.size() == 1) {
+        num_columns[0] = max_batch_elements;
+        return;
+    }
+
+    double total_weight = 0;
+    for (auto const &shard : shards) {
+        total_weight += shard.weight;
+    }
+    PhiloxStream rng(seed, COLUMN_SHARDS_STREAM_IDX, sequence_number);
+    for (int64 column = 0; column < max_batch_elements; ++column) {
+        double point = static_cast<double>(rng() >> 11) * 0x1.0p-53 * total_weight;
+        size_t shard_idx = 0;
+        while (shard_idx + 1 < shards.size() && point >= shards[shard_idx].weight) {
+            point -= shards[shard_idx].weight;
+            ++shard_idx;
+        }
+        ++num_columns[shard_idx];
+    }
+}
+
+/**
+ * Opens shard files (with O_DIRECT) and splits worker threads between them.
+ *
+ * A single file keeps num_rows from the tensor description; with multiple files the number of rows of each shard is derived
+ * from its size and the sum must match num_rows. Compressed shards take the number of rows and chunks from their header.
+ * With config.weights_path set, an alias table of chunk weights is opened (or built) for every shard.
+ */
+inline std::vector<Shard> open(TensorDescription const &tensor_description, SamplerConfig const &config, SamplingParameters const &params) {
+    const auto &file_paths = tensor_description.file_paths;
+    const int64 num_shards = static_cast<int64>(file_paths.size());
+
+    CASSERT(num_shards > 0, "no dataset files given");
+    CASSERT(num_shards <= config.max_num_threads, "each of %ld files needs its own worker thread; max_num_threads: %ld",
+            num_shards, config.max_num_threads);
+    CASSERT(config.weights_path.empty() || config.sampling_mode == WithReplacementSamplingMode,
+            "weighted sampling is not supported in epoch sampling mode");
+
+    std::vector<Shard> shards;
+    int64 total_num_rows = 0;
+    for (int64 shard_idx = 0; shard_idx < num_shards; ++shard_idx) {
+        const std::string &file_path = file_paths[shard_idx];
+        int32 file_descriptor = ::open(file_path.c_str(), O_DIRECT | O_RDONLY);
+        CHECK_SYSCALL(file_descriptor >= 0, "Failed to open file: " << file_path);
+
+        std::shared_ptr<CompressedContainer> container;
+        if (config.storage_format == CompressedStorageFormat) {
+            container = std::make_shared<CompressedContainer>(file_path);
+        }
+
+        int64 num_rows = tensor_description.num_rows;
+        if (container) {
+            num_rows = container->get_header().num_rows;
+        } else if (num_shards > 1) {
+            const int64 file_size = get_file_size(file_descriptor, file_path);
+            CASSERT(file_size % tensor_description.row_size_b == 0, "size of %s (%ld) is not a multiple of row size",
+                    file_path.c_str(), file_size);
+            num_rows = file_size / tensor_description.row_size_b;
+        }
+        const int64 first_row = total_num_rows;
+        total_num_rows += num_rows;
+
+        const int64 shard_size_b = num_rows * tensor_description.row_size_b;
+        CHECK_SYSCALL(::posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_NOREUSE | POSIX_FADV_RANDOM) == 0, "fadvise() failed");
+
+        // raw chunk reads extend past the end of the chunk, so the last chunk is never read
+        const int64 num_chunks = container ? container->get_header().num_chunks : shard_size_b / params.chunk_size_b - 1;
+        CASSERT(num_chunks > 0, "file %s is too small", file_path.c_str());
+
+        std::shared_ptr<AliasTable> alias_table;
+        if (!config.weights_path.empty()) {
+            alias_table = std::make_shared<AliasTable>(
+                    config.weights_path, config.weights_path + ".alias" + std::to_string(shard_idx), first_row, num_rows,
+                    tensor_description.row_size_b, num_chunks, params.chunk_size_b
+            );
+            LOG("Shard " << file_path << " has sampling weight " << alias_table->get_total_weight());
+        }
+
+        shards.emplace_back(Shard{
+                .file_path = file_path,
+                .first_row = first_row,
+                .num_rows = num_rows,
+                .num_chunks = num_chunks,
+                .weight = alias_table ? alias_table->get_total_weight() : static_cast<double>(num_chunks),
+                .alias_table = alias_table,
+                .container = container,
+                .file_descriptor = file_descriptor,
+                .num_workers = config.max_num_threads / num_shards + (shard_idx < config.max_num_threads % num_shards ? 1 : 0),
+                .numa_node = config.numa_policy == NoNumaPolicy ? Numa::UNKNOWN_NODE : Numa::get_file_node(file_descriptor),
+                .stripe = StripeGeometry{.stripe_size_b = 0, .num_devices = 0}
+        });
+
+        if (config.numa_policy != NoNumaPolicy && shards.back().numa_node == Numa::UNKNOWN_NODE) {
+            LOG("Cannot determine NUMA node of the drive holding " << file_path << ", its workers will not be pinned");
+        }
+
+        if (config.submission_order == StripeSubmissionOrder) {
+            StripeGeometry &stripe = shards.back().stripe;
+            stripe = config.stripe_size_b > 0
+                     ? StripeGeometry{.stripe_size_b = config.stripe_size_b, .num_devices = config.num_stripe_devices}
+                     : get_file_stripe_geometry(file_descriptor);
+            if (stripe.num_devices > 1) {
+                LOG("Reads of " << file_path << " are interleaved over " << stripe.num_devices << " devices of "
+                                << stripe.stripe_size_b << "-byte stripes");
+            } else {
+                LOG(file_path << " is not on a RAID-0 array, its reads are ordered by offset only");
+                stripe = StripeGeometry{.stripe_size_b = 0, .num_devices = 0};
+            }
+        }
+    }
+
+    CASSERT(total_num_rows == tensor_description.num_rows, "files contain %ld rows in total, expected %ld",
+            total_num_rows, tensor_description.num_rows);
+
+    double total_weight = 0;
+    for (auto const &shard : shards) {
+        total_weight += shard.weight;
+    }
+    CASSERT(total_weight > 0, "all rows have zero weight");
+
+    if (num_shards > 1 || config.numa_policy != NoNumaPolicy) {
+        for (auto const &shard : shards) {
+            LOG_VARS("Shard", shard.file_path, shard.num_rows, shard.num_chunks, shard.num_workers, shard.numa_node);
+        }
+    }
+
+    return shards;
+}
+
+inline void close(std::vector<Shard> const &shards) {
+    for (auto const &shard : shards) {
+        CHECK_SYSCALL(::close(shard.file_descriptor) == 0, "Failed to close file a file descriptor");
+    }
+}
+
+}
+
+}
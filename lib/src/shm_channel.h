@@ -0,0 +1,266 @@
+#pragma once
+
+#include "utils.h"
+#include "buffers.h"
+#include "stats.h"
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <utility>
+
+namespace nvme_sampler {
+
+/**
+ * Single-producer single-consumer ring of int64 values living in memory shared between processes.
+ *
+ * Only address-free atomics are used and a waiting side sleeps on a shared (not process-private) futex, so a ring works
+ * at any address in any process; a wake-up syscall is issued only if the other side is asleep.
+ */
+struct ShmRing {
+    static const uint32_t CAPACITY = 256;
+    static const int32 SPIN_ITERATIONS = 128;
+
+    alignas(64) std::atomic<uint32_t> head; // next position written by the producer
+    alignas(64) std::atomic<uint32_t> tail; // next position read by the consumer
+    alignas(64) std::atomic<uint32_t> event; // futex word bumped by every push, pop and close
+    std::atomic<uint32_t> num_waiting;
+    std::atomic<uint32_t> closed;
+    int64 values[CAPACITY];
+
+    // rings live in zero-filled shared memory: all-zero is an empty, open ring
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "ShmRing needs address-free atomics");
+
+    bool try_push(int64 value) {
+        const uint32_t head = this->head.load(std::memory_order_relaxed);
+        if (head - this->tail.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        this->values[head % CAPACITY] = value;
+        this->head.store(head + 1, std::memory_order_release);
+        this->notify();
+        return true;
+    }
+
+    bool try_pop(int64 &value) {
+        const uint32_t tail = this->tail.load(std::memory_order_relaxed);
+        if (this->head.load(std::memory_order_acquire) == tail) {
+            return false;
+        }
+        value = this->values[tail % CAPACITY];
+        this->tail.store(tail + 1, std::memory_order_release);
+        this->notify();
+        return true;
+    }
+
+    // returns false if the ring is closed
+    bool push(int64 value) {
+        for (;;) {
+            const uint32_t event = this->event.load(std::memory_order_seq_cst);
+            if (this->closed.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (this->try_push(value)) {
+                return true;
+            }
+            this->sleep(event, nullptr);
+        }
+    }
+
+    // returns false if the ring is closed and empty or no value came within timeout_ns (negative: no timeout)
+    bool pop(int64 &value, int64 timeout_ns = -1) {
+        const int64 deadline_ns = timeout_ns >= 0 ? monotonic_time_ns() + timeout_ns : -1;
+        for (int32 spin_idx = 0; ; ++spin_idx) {
+            const uint32_t event = this->event.load(std::memory_order_seq_cst);
+            if (this->try_pop(value)) {
+                return true;
+            }
+            if (this->closed.load(std::memory_order_acquire)) {
+                return this->try_pop(value);
+            }
+            if (spin_idx < SPIN_ITERATIONS) {
+                continue;
+            }
+
+            if (deadline_ns < 0) {
+                this->sleep(event, nullptr);
+                continue;
+            }
+            const int64 left_ns = deadline_ns - monotonic_time_ns();
+            if (left_ns <= 0) {
+                return false;
+            }
+            const timespec timeout{.tv_sec = left_ns / 1000000000L, .tv_nsec = left_ns % 1000000000L};
+            this->sleep(event, &timeout);
+        }
+    }
+
+    // wakes up both sides; the consumer still gets values pushed before
+    void close() {
+        this->closed.store(1, std::memory_order_seq_cst);
+        this->notify();
+    }
+
+private:
+    void notify() {
+        this->event.fetch_add(1, std::memory_order_seq_cst);
+        if (this->num_waiting.load(std::memory_order_seq_cst) > 0) {
+            futex(FUTEX_WAKE, INT_MAX, nullptr);
+        }
+    }
+
+    // returns at once if the event changed after it was read
+    void sleep(uint32_t event, timespec const *timeout) {
+        this->num_waiting.fetch_add(1, std::memory_order_seq_cst);
+        futex(FUTEX_WAIT, event, timeout);
+        this->num_waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    void futex(int32 operation, uint32_t value, timespec const *timeout) {
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&this->event), operation, value, timeout, nullptr, 0);
+    }
+};
+
+/**
+ * Shared memory of a client of SamplerServer: offsets (in the batch blocks memory) of batches leased for the client and
+ * offsets of batches the client is done with.
+ */
+struct ClientChannel {
+    ShmRing batches; // server -> client
+    ShmRing releases; // client -> server
+};
+
+// sent by a client over the server's unix socket right after connecting
+struct ConnectRequest {
+    int64 version;
+    int64 batch_size;
+    int64 prefetch_batches; // batches leased ahead for the client (fewer than ShmRing::CAPACITY)
+};
+
+// answer to ConnectRequest, sent along with descriptors of the batch blocks memory and the ClientChannel memory
+struct ConnectReply {
+    int64 version;
+    int64 row_size_b; // of rows in batches
+    int64 data_size_b; // of the batch blocks memory
+};
+
+/**
+ * Mapping of a memfd (anonymous shared memory that can be passed to another process).
+ */
+class SharedMemory {
+    int32 file_descriptor{-1};
+    byte *address{nullptr};
+    int64 size{0};
+
+public:
+    SharedMemory() = default;
+
+    // creates zero-filled memory
+    SharedMemory(char const *name, int64 size) : size(size) {
+        this->file_descriptor = ::syscall(SYS_memfd_create, name, 0);
+        CHECK_SYSCALL(this->file_descriptor >= 0, "memfd_create() failed");
+        CHECK_SYSCALL(::ftruncate(this->file_descriptor, size) == 0, "ftruncate() of " << name << " failed");
+        this->map(PROT_READ | PROT_WRITE);
+    }
+
+    // maps memory received from another process (takes ownership of the descriptor)
+    SharedMemory(int32 file_descriptor, int64 size, int32 protection) : file_descriptor(file_descriptor), size(size) {
+        this->map(protection);
+    }
+
+    SharedMemory(SharedMemory const &) = delete;
+
+    SharedMemory &operator=(SharedMemory const &) = delete;
+
+    ~SharedMemory() {
+        if (this->address) {
+            ::munmap(this->address, this->size);
+        }
+        if (this->file_descriptor >= 0) {
+            ::close(this->file_descriptor);
+        }
+    }
+
+    byte *get() const {
+        return this->address;
+    }
+
+    template<typename T>
+    T *get_as() const {
+        return reinterpret_cast<T *>(this->address);
+    }
+
+    int32 get_file_descriptor() const {
+        return this->file_descriptor;
+    }
+
+    int64 get_size() const {
+        return this->size;
+    }
+
+private:
+    void map(int32 protection) {
+        void *address = ::mmap(nullptr, this->size, protection, MAP_SHARED, this->file_descriptor, 0);
+        CHECK_SYSCALL(address != MAP_FAILED, "mmap() of shared memory failed");
+        this->address = static_cast<byte *>(address);
+    }
+};
+
+namespace ShmChannel {
+
+static const int64 PROTOCOL_VERSION = 1;
+static const int32 NUM_PASSED_FDS = 2; // batch blocks memory, ClientChannel memory
+
+// sends a message with file descriptors (SCM_RIGHTS) over a unix socket; returns false if the peer is gone
+template<typename T>
+bool send_message(int32 socket, T const &message, int32 const *fds, int32 num_fds) {
+    char control[CMSG_SPACE(sizeof(int32) * NUM_PASSED_FDS)] = {};
+    iovec io{.iov_base = const_cast<T *>(&message), .iov_len = sizeof(T)};
+    msghdr header{};
+    header.msg_iov = &io;
+    header.msg_iovlen = 1;
+    if (num_fds > 0) {
+        header.msg_control = control;
+        header.msg_controllen = CMSG_SPACE(sizeof(int32) * num_fds);
+        cmsghdr *control_header = CMSG_FIRSTHDR(&header);
+        control_header->cmsg_level = SOL_SOCKET;
+        control_header->cmsg_type = SCM_RIGHTS;
+        control_header->cmsg_len = CMSG_LEN(sizeof(int32) * num_fds);
+        std::memcpy(CMSG_DATA(control_header), fds, sizeof(int32) * num_fds);
+    }
+    return ::sendmsg(socket, &header, MSG_NOSIGNAL) == static_cast<ssize_t>(sizeof(T));
+}
+
+// receives a message sent by send_message(); returns false if the peer is gone or the message is malformed
+template<typename T>
+bool receive_message(int32 socket, T *message, int32 *fds, int32 num_fds) {
+    char control[CMSG_SPACE(sizeof(int32) * NUM_PASSED_FDS)] = {};
+    iovec io{.iov_base = message, .iov_len = sizeof(T)};
+    msghdr header{};
+    header.msg_iov = &io;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    if (::recvmsg(socket, &header, MSG_CMSG_CLOEXEC) != static_cast<ssize_t>(sizeof(T))) {
+        return false;
+    }
+    if (num_fds == 0) {
+        return true;
+    }
+    cmsghdr *control_header = CMSG_FIRSTHDR(&header);
+    if (!control_header || control_header->cmsg_type != SCM_RIGHTS || control_header->cmsg_len != CMSG_LEN(sizeof(int32) * num_fds)) {
+        return false;
+    }
+    std::memcpy(fds, CMSG_DATA(control_header), sizeof(int32) * num_fds);
+    return true;
+}
+
+}
+
+}
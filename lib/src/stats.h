@@ -0,0 +1,135 @@
+#pragma once
+
+#include "utils.h"
+
+#include <atomic>
+#include <ctime>
+
+namespace nvme_sampler {
+
+inline int64 monotonic_time_ns() {
+    timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Counter with a single writer thread and any number of readers.
+ *
+ * Updates are a relaxed load and store (no locked instruction), so counters can stay enabled on hot paths.
+ */
+struct StatCounter {
+    std::atomic<int64> value{0};
+
+    inline void add(int64 delta) {
+        this->value.store(this->value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    inline void set(int64 value) {
+        this->value.store(value, std::memory_order_relaxed);
+    }
+
+    inline int64 get() const {
+        return this->value.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Log-linear histogram of durations in nanoseconds: every power of two is split into 4 buckets (~25% resolution).
+ */
+struct LatencyHistogram {
+    static const int32 SUB_BUCKETS_BITS = 2;
+    static const int32 SUB_BUCKETS = 1 << SUB_BUCKETS_BITS;
+    static const int32 NUM_BUCKETS = 192;
+
+    StatCounter buckets[NUM_BUCKETS];
+
+    inline void record(int64 value_ns) {
+        this->buckets[bucket_index(value_ns)].add(1);
+    }
+
+    static inline int32 bucket_index(int64 value) {
+        if (value < SUB_BUCKETS) {
+            return static_cast<int32>(std::max(value, 0L));
+        }
+        const int32 msb = 63 - __builtin_clzll(static_cast<uint64>(value));
+        const int32 sub_bucket = static_cast<int32>(value >> (msb - SUB_BUCKETS_BITS)) & (SUB_BUCKETS - 1);
+        return std::min((msb - SUB_BUCKETS_BITS + 1) * SUB_BUCKETS + sub_bucket, NUM_BUCKETS - 1);
+    }
+
+    // exclusive upper bound of values stored in the bucket
+    static inline int64 bucket_upper_bound(int32 bucket_idx) {
+        if (bucket_idx < SUB_BUCKETS) {
+            return bucket_idx + 1;
+        }
+        const int32 shift = bucket_idx / SUB_BUCKETS - 1;
+        return static_cast<int64>(SUB_BUCKETS + bucket_idx % SUB_BUCKETS + 1) << shift;
+    }
+};
+
+/**
+ * Point-in-time copy of one or more histograms.
+ */
+struct LatencySummary {
+    int64 counts[LatencyHistogram::NUM_BUCKETS] = {};
+    int64 total = 0;
+
+    void add(LatencyHistogram const &histogram) {
+        for (int32 bucket_idx = 0; bucket_idx < LatencyHistogram::NUM_BUCKETS; ++bucket_idx) {
+            const int64 count = histogram.buckets[bucket_idx].get();
+            this->counts[bucket_idx] += count;
+            this->total += count;
+        }
+    }
+
+    // leaves the values recorded after the earlier summary of the same histograms
+    void subtract(LatencySummary const &earlier) {
+        for (int32 bucket_idx = 0; bucket_idx < LatencyHistogram::NUM_BUCKETS; ++bucket_idx) {
+            this->counts[bucket_idx] -= earlier.counts[bucket_idx];
+        }
+        this->total -= earlier.total;
+    }
+
+    // returns upper bound of the bucket containing the q-th quantile (0 if the histogram is empty)
+    int64 quantile_ns(double q) const {
+        const int64 rank = static_cast<int64>(q * this->total);
+        int64 seen = 0;
+        for (int32 bucket_idx = 0; bucket_idx < LatencyHistogram::NUM_BUCKETS; ++bucket_idx) {
+            seen += this->counts[bucket_idx];
+            if (seen > rank) {
+                return LatencyHistogram::bucket_upper_bound(bucket_idx);
+            }
+        }
+        return 0;
+    }
+};
+
+struct WorkerCounters {
+    StatCounter reads_submitted;
+    StatCounter reads_completed;
+    StatCounter bytes_read;
+    StatCounter bytes_wasted; // read only because of sector alignment
+    StatCounter samples_read;
+    StatCounter io_wait_ns; // submitting reads and waiting for completions
+    StatCounter scatter_ns; // copying finished reads into batch blocks
+    StatCounter decompress_ns; // decompressing chunks of compressed shards
+    StatCounter idle_ns; // waiting for work (added when a wait ends)
+    StatCounter idle_since_ns; // start of the ongoing wait for work, 0 if there is none
+    LatencyHistogram io_latency;
+};
+
+// Pages backing sampler memory (page sizes are 0 if there is no such memory, e.g. read buffers in zero-copy mode)
+struct MemoryStats {
+    int64 batch_blocks_page_size_b;
+    int64 read_buffers_page_size_b; // smallest over workers
+    int64 locked_b; // mlock()-ed bytes
+};
+
+struct ConsumerCounters {
+    StatCounter blocks_consumed;
+    StatCounter batches_consumed;
+    StatCounter samples_consumed;
+    StatCounter wait_ns; // waiting for workers to fill the next batch block
+};
+
+}
@@ -0,0 +1,30 @@
+#include "calculator.h"
+
+using namespace nvme_sampler;
+
+// sampling parameters chosen for a dataset of 16-byte rows and a batch of max_batch_elements rows
+SamplingParameters calculate(int64 max_batch_elements, int64 memory_usage_limit_b, int64 compressed_chunk_rows = 0) {
+    SamplerConfig config{.max_batch_elements = max_batch_elements, .max_num_threads = 1, .memory_usage_limit_b = memory_usage_limit_b};
+    return SamplingParametersCalculator::calculate(1L << 40, 16, config, compressed_chunk_rows);
+}
+
+void check_num_batches_in_block(int64 memory_usage_limit_b, int64 expected_num_batches_in_block) {
+    for (int64 compressed_chunk_rows : {0L, 256L}) {
+        SamplingParameters params = calculate(1, memory_usage_limit_b, compressed_chunk_rows);
+        CASSERT(params.num_batches_in_block == expected_num_batches_in_block,
+                "memory_usage_limit_b: %ld; compressed_chunk_rows: %ld; num_batches_in_block: %ld (expected %ld)",
+                memory_usage_limit_b, compressed_chunk_rows, params.num_batches_in_block, expected_num_batches_in_block);
+    }
+}
+
+int main() {
+    // 2 batch blocks of 16-byte batches: the largest power of two of batches using less than memory_usage_limit_b
+    LOG("Checking num_batches_in_block");
+    check_num_batches_in_block(1L << 20, 1L << 14);
+    check_num_batches_in_block(3L << 20, 1L << 16);
+    // block sizes above 2^31 rows, up to MAX_NUM_BATCHES_IN_BLOCK
+    check_num_batches_in_block(3L << 35, 1L << 31);
+    check_num_batches_in_block(1L << 40, SamplingParametersCalculator::MAX_NUM_BATCHES_IN_BLOCK);
+
+    return 0;
+}
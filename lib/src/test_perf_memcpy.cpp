@@ -1,6 +1,9 @@
 #include "memcpy.h"
+#include "pages.h"
 #include <sys/time.h>
+#include <cstring>
 #include <numeric>
+#include <vector>
 
 using namespace nvme_sampler;
 
@@ -19,6 +22,7 @@ void test_memcpy(Fun fun, int64 chunk_size, int64 mem_size, int64 num_iterations
         for (int64 block_idx = 0; block_idx < (mem_size / chunk_size); ++block_idx) {
             fun(dst + (block_idx * chunk_size), src + (block_idx * chunk_size), chunk_size);
         }
+        Memcpy::store_fence();
         double end_time = get_wall_time();
         double duration = end_time - start_time;
 
@@ -28,18 +32,153 @@ void test_memcpy(Fun fun, int64 chunk_size, int64 mem_size, int64 num_iterations
     }
 }
 
+// copies chunks to pseudo-randomly permuted destinations (like workers scattering rows into a batch block): stresses the TLB
+template<typename Fun>
+void test_scatter(Fun fun, int64 chunk_size, int64 mem_size, int64 num_iterations, const char *src, char *dst) {
+    const int64 num_chunks = mem_size / chunk_size;
+    int64 stride = 1000003; // prime
+    while (std::gcd(stride, num_chunks) != 1) {
+        stride += 2;
+    }
+
+    for (int32 run_idx = 0; run_idx < num_iterations; ++run_idx) {
+        double start_time = get_wall_time();
+        for (int64 block_idx = 0; block_idx < num_chunks; ++block_idx) {
+            const int64 dst_idx = (block_idx * stride) % num_chunks;
+            fun(dst + (dst_idx * chunk_size), src + (block_idx * chunk_size), chunk_size);
+        }
+        Memcpy::store_fence();
+        double end_time = get_wall_time();
+        double duration = end_time - start_time;
+
+        const int64 last_dst_idx = ((num_chunks - 1) * stride) % num_chunks;
+        assert(memcmp(src + (num_chunks - 1) * chunk_size, dst + last_dst_idx * chunk_size, chunk_size) == 0);
+
+        printf("Duration: %lf; bw=%lf GiB/s\n", duration, mem_size / duration / (1 << 30));
+    }
+}
+
+// like test_scatter(), but with a scatter loop specialized for the chunk size, fed with batches of destinations like in workers
+void test_fixed_size_scatter(Memcpy::ScatterFunction scatter, int64 chunk_size, int64 mem_size, int64 num_iterations, const char *src,
+                             char *dst) {
+    const int32 destination_batch_size = 64;
+    const int64 num_chunks = mem_size / chunk_size;
+    int64 stride = 1000003; // prime
+    while (std::gcd(stride, num_chunks) != 1) {
+        stride += 2;
+    }
+
+    std::vector<byte *> destinations(num_chunks);
+    for (int32 run_idx = 0; run_idx < num_iterations; ++run_idx) {
+        double start_time = get_wall_time();
+        for (int64 first_block_idx = 0; first_block_idx < num_chunks; first_block_idx += destination_batch_size) {
+            const int32 num_destinations = static_cast<int32>(
+                    std::min<int64>(destination_batch_size + Memcpy::PREFETCH_DISTANCE, num_chunks - first_block_idx));
+            for (int32 idx = 0; idx < num_destinations; ++idx) {
+                const int64 dst_idx = ((first_block_idx + idx) * stride) % num_chunks;
+                destinations[idx] = reinterpret_cast<byte *>(dst + dst_idx * chunk_size);
+            }
+            scatter(destinations.data(), reinterpret_cast<byte const *>(src + first_block_idx * chunk_size), chunk_size,
+                    std::min(destination_batch_size, num_destinations), num_destinations);
+        }
+        Memcpy::store_fence();
+        double end_time = get_wall_time();
+        double duration = end_time - start_time;
+
+        const int64 last_dst_idx = ((num_chunks - 1) * stride) % num_chunks;
+        assert(memcmp(src + (num_chunks - 1) * chunk_size, dst + last_dst_idx * chunk_size, chunk_size) == 0);
+
+        printf("Duration: %lf; bw=%lf GiB/s\n", duration, mem_size / duration / (1 << 30));
+    }
+}
+
+// copies of every size up to a few vectors and a few row sizes, from every dst offset within a cache line, compared byte by
+// byte with memcpy() (including the bytes around dst, which must stay untouched)
+void check_copy(Memcpy::CopyKernel const &kernel) {
+    const int64 max_size = 4097;
+    const int64 cache_line_size = 64;
+    std::vector<byte> src(max_size + 64);
+    std::iota(src.begin(), src.end(), 7);
+    std::vector<byte> dst_memory(max_size + 3 * cache_line_size), expected_memory(dst_memory.size());
+    byte *dst_base = reinterpret_cast<byte *>(align_up(reinterpret_cast<int64>(dst_memory.data()), cache_line_size));
+    byte *expected_base = reinterpret_cast<byte *>(align_up(reinterpret_cast<int64>(expected_memory.data()), cache_line_size));
+
+    std::vector<int64> sizes;
+    for (int64 size = 0; size <= 520; ++size) {
+        sizes.push_back(size);
+    }
+    for (int64 size : {1016L, 1023L, 1024L, 1025L, 4095L, 4096L, 4097L}) {
+        sizes.push_back(size);
+    }
+
+    for (int64 size : sizes) {
+        for (int64 src_offset : {0L, 1L, 3L, 8L, 31L}) {
+            for (int64 dst_offset = 0; dst_offset < cache_line_size; ++dst_offset) {
+                std::fill(dst_base, dst_base + max_size + 2 * cache_line_size, 0xa5);
+                std::fill(expected_base, expected_base + max_size + 2 * cache_line_size, 0xa5);
+                kernel.copy(dst_base + dst_offset, src.data() + src_offset, size);
+                Memcpy::store_fence();
+                ::memcpy(expected_base + dst_offset, src.data() + src_offset, size);
+                CASSERT(::memcmp(dst_base, expected_base, max_size + 2 * cache_line_size) == 0,
+                        "%s: size: %ld; src_offset: %ld; dst_offset: %ld", kernel.name, size, src_offset, dst_offset);
+            }
+        }
+    }
+}
+
+// every specialized scatter loop against memcpy() of each row, with rows packed and with a row stride (as with a projection)
+void check_fixed_size_scatter(Memcpy::CopyKernel const &kernel) {
+    const int32 num_rows = 70;
+    int32 num_specialized = 0;
+    for (int64 row_size = Memcpy::SCATTER_ALIGNMENT; row_size <= 8192; row_size += Memcpy::SCATTER_ALIGNMENT) {
+        Memcpy::ScatterFunction const scatter = kernel.select_scatter(row_size);
+        if (!scatter) {
+            continue;
+        }
+        ++num_specialized;
+
+        for (int64 row_stride : {row_size, row_size + 8}) {
+            std::vector<byte> src(num_rows * row_stride + 4);
+            std::iota(src.begin(), src.end(), 11);
+            std::vector<byte> dst_memory((num_rows + 1) * row_size), expected_memory(dst_memory.size());
+            byte *dst_base = reinterpret_cast<byte *>(align_up(reinterpret_cast<int64>(dst_memory.data()), Memcpy::SCATTER_ALIGNMENT));
+            byte *expected_base = reinterpret_cast<byte *>(align_up(reinterpret_cast<int64>(expected_memory.data()), Memcpy::SCATTER_ALIGNMENT));
+            std::fill(dst_base, dst_base + num_rows * row_size, 0xa5);
+            std::fill(expected_base, expected_base + num_rows * row_size, 0xa5);
+
+            // rows go to permuted slots; the last destinations are only prefetched, as when workers pass the next batch
+            byte *destinations[num_rows];
+            for (int32 row_idx = 0; row_idx < num_rows; ++row_idx) {
+                destinations[row_idx] = dst_base + ((row_idx * 37) % num_rows) * row_size;
+                ::memcpy(expected_base + ((row_idx * 37) % num_rows) * row_size, src.data() + 4 + row_idx * row_stride, row_size);
+            }
+            const int32 num_scattered = num_rows - Memcpy::PREFETCH_DISTANCE;
+            scatter(destinations, src.data() + 4, row_stride, num_scattered, num_rows);
+            scatter(destinations + num_scattered, src.data() + 4 + num_scattered * row_stride, row_stride, num_rows - num_scattered,
+                    num_rows - num_scattered);
+            Memcpy::store_fence();
+
+            CASSERT(::memcmp(dst_base, expected_base, num_rows * row_size) == 0, "%s: row_size: %ld; row_stride: %ld",
+                    kernel.name, row_size, row_stride);
+        }
+    }
+    CASSERT(num_specialized > 0, "%s has no specialized scatter loops", kernel.name);
+}
+
 int main(int argc, char **argv) {
-    assert(argc == 6);
+    assert(argc == 6 || argc == 7);
     int64 chunk_size = std::atol(argv[1]);
     int32 src_alignment = std::atoi(argv[2]);
     int32 dst_alignment = std::atoi(argv[3]);
     int64 mem_size = std::atol(argv[4]);
     int64 num_iterations = std::atol(argv[5]);
+    auto huge_pages = static_cast<HugePagesPolicyType>(argc > 6 ? std::atoi(argv[6]) : NoHugePages); // pages of dst
 
     assert(mem_size % 4 == 0);
 
     auto src = new char[align_up(mem_size + src_alignment, src_alignment)];
-    auto dst = new char[align_up(mem_size + dst_alignment, dst_alignment)];
+    PageBuffer dst_memory(align_up(mem_size + dst_alignment, dst_alignment), huge_pages, "dst");
+    auto dst = reinterpret_cast<char *>(dst_memory.get());
     src = (char *) align_up((long) src, src_alignment);
     dst = (char *) align_up((long) dst, dst_alignment);
     assert(((long) src) % src_alignment == 0);
@@ -48,20 +187,39 @@ int main(int argc, char **argv) {
     std::iota(reinterpret_cast<int32 *>(src), reinterpret_cast<int32 *>(src + mem_size), 0);
     std::iota(reinterpret_cast<int32 *>(dst), reinterpret_cast<int32 *>(dst + mem_size), 12341);
 
+    LOG("Checking kernels against memcpy()");
+    for (auto const &kernel : Memcpy::KERNELS) {
+        if (kernel.is_supported()) {
+            check_copy(kernel);
+            check_fixed_size_scatter(kernel);
+        }
+    }
+
     LOG("memcpy() performance test");
-    LOG_VARS("Params", mem_size, chunk_size, src_alignment, dst_alignment);
+    const int64 dst_page_size = dst_memory.get_page_size();
+    LOG_VARS("Params", mem_size, chunk_size, src_alignment, dst_alignment, dst_page_size);
 
     LOG("memcpy");
     test_memcpy(memcpy, chunk_size, mem_size, num_iterations, src, dst);
 
-    LOG("smart_memcpy");
-    auto fun = (chunk_size >= 1024 && src_alignment % 32 == 0 && dst_alignment % 32 == 0 && chunk_size % 32 == 0) ? smart_memcpy<true>
-                                                                                                                  : smart_memcpy<false>;
-    test_memcpy(fun, chunk_size, mem_size, num_iterations, src, dst);
+    LOG("Kernel selected by workers for this chunk size: " << Memcpy::select_kernel(chunk_size).name);
+    for (auto const &kernel : Memcpy::KERNELS) {
+        if (!kernel.is_supported()) {
+            LOG(kernel.name << " is not supported by this CPU");
+            continue;
+        }
+
+        LOG(kernel.name);
+        test_memcpy(kernel.copy, chunk_size, mem_size, num_iterations, src, dst);
+
+        LOG(kernel.name << " scatter");
+        test_scatter(kernel.copy, chunk_size, mem_size, num_iterations, src, dst);
 
-    LOG("avx2nt_memcpy");
-    if (src_alignment % 32 == 0 && dst_alignment % 32 == 0) {
-        test_memcpy(avx2nt_memcpy, chunk_size, mem_size, num_iterations, src, dst);
+        Memcpy::ScatterFunction const fixed_size_scatter = kernel.select_scatter(chunk_size);
+        if (fixed_size_scatter && dst_alignment % Memcpy::SCATTER_ALIGNMENT == 0) {
+            LOG(kernel.name << " fixed-size scatter");
+            test_fixed_size_scatter(fixed_size_scatter, chunk_size, mem_size, num_iterations, src, dst);
+        }
     }
 
     return 0;
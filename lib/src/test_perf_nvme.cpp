@@ -3,25 +3,33 @@
 using namespace nvme_sampler;
 
 int main(int argc, char **argv) {
-    assert(argc == 7);
+    assert(argc >= 7 && argc <= 9);
 
-    auto file_path = std::string(argv[1]);
+    std::vector<std::string> file_paths; // comma-separated list of shards
+    std::stringstream file_paths_stream(argv[1]);
+    for (std::string file_path; std::getline(file_paths_stream, file_path, ',');) {
+        file_paths.push_back(file_path);
+    }
     auto row_size = std::atol(argv[2]);
     auto num_rows = std::atol(argv[3]);
     auto max_batch_elements = std::atol(argv[4]);
     auto max_num_threads = std::atoi(argv[5]);
     auto memory_usage_limit_b = std::atol(argv[6]);
+    auto io_engine = static_cast<IoEngineType>(argc > 7 ? std::atoi(argv[7]) : LibAioEngineType);
+    auto auto_tune = argc > 8 && std::atoi(argv[8]) != 0; // the tuned concurrency is logged when it changes and at the end
 
     TensorDescription tensor_description = {
             .num_rows = num_rows,
             .row_size_b = row_size,
-            .file_path = file_path,
+            .file_paths = file_paths,
     };
 
     SamplerConfig config = {
             .max_batch_elements = max_batch_elements,
             .max_num_threads = max_num_threads,
             .memory_usage_limit_b = memory_usage_limit_b,
+            .io_engine = io_engine,
+            .auto_tune = auto_tune
     };
 
     NvmeSampler sampler(tensor_description, config, create_default_allocator());
@@ -29,6 +37,7 @@ int main(int argc, char **argv) {
     for (int i = 0; i < tensor_description.num_rows * 4; ++i) {
         sampler.get_next_batch(1);
     }
+    LOG_VARS("Concurrency", sampler.get_num_active_workers(), sampler.get_io_queue_depth());
 
     return 0;
 }
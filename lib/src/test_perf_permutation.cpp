@@ -0,0 +1,65 @@
+#include "permutation.h"
+#include <sys/time.h>
+#include <cstdio>
+#include <vector>
+
+using namespace nvme_sampler;
+
+double get_wall_time() {
+    timeval tv;
+    int32 result = gettimeofday(&tv, nullptr);
+    assert(result == 0);
+    return static_cast<double>(tv.tv_sec) + (tv.tv_usec / 1e6);
+}
+
+// every index of [0, size) is hit exactly once
+void check_bijection(int64 size, uint64 key) {
+    FeistelPermutation permutation(size, key);
+    std::vector<bool> seen(size);
+    for (int64 index = 0; index < size; ++index) {
+        const int64 value = permutation(index);
+        CASSERT(value >= 0 && value < size, "size: %ld; key: %lu; index: %ld -> %ld", size, key, index, value);
+        CASSERT(!seen[value], "size: %ld; key: %lu; index: %ld -> %ld twice", size, key, index, value);
+        seen[value] = true;
+    }
+}
+
+void test_permutation(int64 size, int64 num_iterations) {
+    for (int32 run_idx = 0; run_idx < num_iterations; ++run_idx) {
+        FeistelPermutation permutation(size, run_idx);
+        double start_time = get_wall_time();
+        int64 sum = 0;
+        for (int64 index = 0; index < size; ++index) {
+            sum += permutation(index);
+        }
+        double end_time = get_wall_time();
+        double duration = end_time - start_time;
+
+        CASSERT(sum == size * (size - 1) / 2, "sum: %ld", sum);
+
+        printf("Duration: %lf; %lf ns per element\n", duration, duration * 1e9 / size);
+    }
+}
+
+int main(int argc, char **argv) {
+    assert(argc <= 3);
+    int64 size = argc > 1 ? std::atol(argv[1]) : 1L << 26;
+    int64 num_iterations = argc > 2 ? std::atol(argv[2]) : 3;
+
+    // all small sizes (odd and even num_bits, powers of two and the sizes between them) and a few larger ones
+    LOG("Checking bijection");
+    for (uint64 key : {0UL, 1UL, 0x123456789abcdefUL}) {
+        for (int64 small_size = 1; small_size <= 4096; ++small_size) {
+            check_bijection(small_size, key);
+        }
+        for (int64 large_size : {65535L, 65536L, 65537L, 3L << 15, 1L << 20, 1L << 21, (1L << 21) + 12345, (1L << 23) - 1}) {
+            check_bijection(large_size, key);
+        }
+    }
+
+    LOG("FeistelPermutation performance test");
+    LOG_VARS("Params", size, num_iterations);
+    test_permutation(size, num_iterations);
+
+    return 0;
+}
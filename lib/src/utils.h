@@ -37,6 +37,7 @@ struct var_printer {
 
 #define LOG(block) do { std::cout << "[NvmeSampler] " << block << std::endl; } while(0)
 
+#define LOG_VARS8(block, a, b, c, d, e, f, g) LOG(block << "; " << (var_printer{ #a, #b, #c, #d, #e, #f, #g}.print(a, b, c, d, e, f, g).buffer.str()))
 #define LOG_VARS7(block, a, b, c, d, e, f) LOG(block << "; " << (var_printer{ #a, #b, #c, #d, #e, #f}.print(a, b, c, d, e, f).buffer.str()))
 #define LOG_VARS6(block, a, b, c, d, e) LOG(block << "; " << (var_printer{ #a, #b, #c, #d, #e}.print(a, b, c, d, e).buffer.str()))
 #define LOG_VARS5(block, a, b, c, d) LOG(block << "; " << (var_printer{ #a, #b, #c, #d}.print(a, b, c, d).buffer.str()))
@@ -47,7 +48,7 @@ struct var_printer {
 #define MKFN_N(fn, n0, n1, n2, n3, n4, n5, n6, n7, n8, n, ...) fn##n
 #define LOG_VARS(...) MKFN(LOG_VARS,##__VA_ARGS__)
 
-#define DISABLED_ASSERT(cond, fmt, args...) do { (void)((cond))} while(0);
+#define DISABLED_ASSERT(cond, fmt, args...) do { (void)sizeof((cond)); } while(0); // the condition is not evaluated
 
 #define ENABLED_ASSERT(cond, fmt, ...) \
 do { \
@@ -68,7 +69,9 @@ do { \
 #define ASSERTION_LEVEL_ALL 1
 #define ASSERTION_LEVEL_SOME 2
 #define ASSERTION_LEVEL_ALMOST_NONE 3
+#ifndef ASSERTIONS_LEVEL // e.g. -DASSERTIONS_LEVEL=ASSERTION_LEVEL_SOME drops debug assertions (checked per row in hot loops)
 #define ASSERTIONS_LEVEL ASSERTION_LEVEL_ALL
+#endif
 
 #if ASSERTIONS_LEVEL == ASSERTION_LEVEL_ALL
 #define CASSERT ENABLED_ASSERT // critical assertion
@@ -130,4 +133,15 @@ constexpr inline int32_t round_up_to_pow2(int32_t v) {
     return ++v;
 };
 
+constexpr inline int64_t round_up_to_pow2(int64_t v) {
+    v--;
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+    v |= v >> 32;
+    return ++v;
+};
+
 }
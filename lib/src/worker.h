@@ -3,147 +3,387 @@
 #include "utils.h"
 #include "buffers.h"
 #include "memcpy.h"
-#include "blocking_queue.h"
+#include "dequantize.h"
+#include "ring_queue.h"
 #include "batch_block.h"
-#include "lcg.h"
+#include "io_engine.h"
+#include "stats.h"
+#include "shard.h"
+#include "permutation.h"
+#include "philox.h"
+#include "compression.h"
+#include "pages.h"
 
-#include <libaio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
 
 namespace nvme_sampler {
 
 using SamplingParametersCalculator::PAGE_SIZE;
 using SamplingParametersCalculator::SECTOR_SIZE;
 
+struct ReadBatchBlockTask;
+
+struct ReadBatchBlockSubTask {
+    ReadBatchBlockTask *parent_task;
+    int32 sub_task_id;
+    int64 shard_idx; // the sub-task goes to the work queue of this shard
+    int64 first_column; // sub-task fills columns [first_column, first_column + num_columns) of every batch in the block
+    int64 num_columns;
+};
+
+typedef RingQueue<ReadBatchBlockSubTask *> WorkQueue;
+typedef WorkQueue *WorkQueuePtr;
+
+/**
+ * Filling of a batch block, split into sub-tasks (one per worker). Tasks and their sub-tasks are allocated once per block
+ * and reused every time the block is scheduled; the worker finishing the last sub-task hands the block to the consumer.
+ */
 struct ReadBatchBlockTask {
-    BatchBlockPtr block;
-    const int64 num_sub_tasks;
+    const BatchBlockPtr block;
+    std::vector<ReadBatchBlockSubTask> sub_tasks;
 
 private:
-    std::mutex mutex;
-    BlockingQueue<BatchBlockPtr> *result_queue;
-    int32 num_sub_tasks_done{0};
+    ReadyBlocks *result_queue;
+    std::atomic<int64> num_sub_tasks_left{0};
+    std::atomic<int64> epoch{-1};
+    int64 first_read_idx{0};
 
 public:
-    ReadBatchBlockTask(BatchBlockPtr block, BlockingQueue<BatchBlockPtr> *result_queue, int64 num_sub_tasks)
-            : block(block), num_sub_tasks(num_sub_tasks), result_queue(result_queue) {}
+    ReadBatchBlockTask(BatchBlockPtr block, ReadyBlocks *result_queue) : block(block), result_queue(result_queue) {}
 
-    void mark_sub_task_as_done() {
-        std::lock_guard<std::mutex> lock(this->mutex);
-        num_sub_tasks_done++;
+    ReadBatchBlockTask(ReadBatchBlockTask const &) = delete;
+
+    ReadBatchBlockTask &operator=(ReadBatchBlockTask const &) = delete;
+
+    void add_sub_task(int64 shard_idx, int64 first_column, int64 num_columns) {
+        this->sub_tasks.push_back(ReadBatchBlockSubTask{
+                .parent_task = this,
+                .sub_task_id = static_cast<int32>(this->sub_tasks.size()),
+                .shard_idx = shard_idx,
+                .first_column = first_column,
+                .num_columns = num_columns
+        });
+    }
 
-        if (num_sub_tasks_done == num_sub_tasks) {
-            block->read_idx = 0;
+    // must be called before sub-tasks are pushed to work queues; sequence_number: of this filling of the block,
+    // first_read_idx: consumers start reading the filled block at this sample
+    void reset(int64 sequence_number, int64 first_read_idx) {
+        this->block->sequence_number = sequence_number;
+        this->first_read_idx = first_read_idx;
+        this->epoch.store(-1, std::memory_order_relaxed);
+        this->num_sub_tasks_left.store(static_cast<int64>(this->sub_tasks.size()), std::memory_order_release);
+    }
+
+    // first_epoch: epoch of the first chunk read by the sub-task (-1 if it read nothing)
+    void mark_sub_task_as_done(int64 first_epoch) {
+        int64 epoch = this->epoch.load(std::memory_order_relaxed);
+        while (first_epoch >= 0 && (epoch < 0 || first_epoch < epoch) &&
+               !this->epoch.compare_exchange_weak(epoch, first_epoch, std::memory_order_relaxed)) {}
+
+        // the last sub-task sees writes of all the others
+        if (this->num_sub_tasks_left.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            block->read_idx.store(this->first_read_idx, std::memory_order_relaxed);
+            block->epoch = std::max(this->epoch.load(std::memory_order_relaxed), 0L);
             result_queue->push(block);
         }
     }
 };
 
-enum TaskType {
-    ReadBatchBlockTaskType
+struct ReadDescription {
+    int64 chunk_idx;
+    int64 read_offset;
+    int64 read_size;
+    int64 data_offset; // of the first row in read data (negative if leading bytes outside of the projection were not read)
+    int64 num_elements; // taken into the column
+    int64 num_read_elements; // rows in the read (more than num_elements for the last read of a column)
+    int64 first_element; // row of the read taken first; taken rows wrap around to the first row of the read
+    int64 target_column; // within the sub-task
+    int64 compressed_size_b; // of the chunk in a compressed shard (0 for raw reads)
+    FeistelPermutation permutation; // of rows of the target column
+    int64 permutation_offset; // index in the permutation of the first element of the read
+    int32 slot = 0;
+    byte *buffer = nullptr; // destination of the read
+    int64 submit_time_ns = 0;
 };
 
-struct SubTask {
-    TaskType type;
+/**
+ * Position in the chunk sequence of a shard, shared by its workers in EpochSamplingMode.
+ *
+ * Position p is element p % num_chunks of the permutation of epoch p / num_chunks, so workers split every epoch between
+ * them dynamically and each chunk is read once per epoch.
+ */
+struct ChunkEpochCursor {
+    const int64 num_chunks;
+    const int32 seed;
+    std::atomic<int64> position{0};
 
-    virtual ~SubTask() {}
+    ChunkEpochCursor(int64 num_chunks, int32 seed) : num_chunks(num_chunks), seed(seed) {}
 
-    SubTask(TaskType type) : type(type) {}
+    FeistelPermutation get_permutation(int64 epoch) const {
+        return FeistelPermutation(this->num_chunks, mix64((static_cast<uint64>(static_cast<uint32_t>(this->seed)) << 32) + epoch));
+    }
 };
 
-struct ReadBatchBlockSubTask : SubTask {
-    ReadBatchBlockSubTask(std::shared_ptr<ReadBatchBlockTask> parent_task, int32 sub_task_id)
-            : SubTask(ReadBatchBlockTaskType), parent_task(parent_task), sub_task_id(sub_task_id) {}
+/**
+ * Concurrency of the worker pool of a shard, changed by AutoTuner while workers run: only the first num_active_workers
+ * workers of the pool take sub-tasks (the others sleep) and every worker keeps at most queue_depth reads in flight.
+ * Both start at their maximum, the pool size and SamplerConfig::io_queue_depth (buffers are allocated for it).
+ */
+class PoolConcurrency {
+    std::atomic<int64> num_active_workers;
+    std::atomic<int32> queue_depth;
+    std::mutex mutex;
+    std::condition_variable activated;
+    bool closed{false};
+
+public:
+    const int64 num_workers;
 
-    std::shared_ptr<ReadBatchBlockTask> parent_task;
-    int32 sub_task_id;
-};
+    PoolConcurrency(int64 num_workers, int32 queue_depth)
+            : num_active_workers(num_workers), queue_depth(queue_depth), num_workers(num_workers) {}
 
+    int64 get_num_active_workers() const {
+        return std::min(this->num_active_workers.load(std::memory_order_relaxed), this->num_workers);
+    }
 
-typedef std::shared_ptr<SubTask> SubTaskPtr;
-typedef BlockingQueue<SubTaskPtr> WorkQueue;
-typedef WorkQueue *WorkQueuePtr;
+    int32 get_queue_depth() const {
+        return this->queue_depth.load(std::memory_order_relaxed);
+    }
 
-struct ReadDescription {
-    int64 chunk_idx;
-    int64 read_offset;
-    int64 read_size;
-    int64 data_offset;
-    int64 num_elements;
-    int64 target_column;
+    void set_queue_depth(int32 queue_depth) {
+        this->queue_depth.store(queue_depth, std::memory_order_relaxed);
+    }
 
-    struct Permutation {
-        RawLCG::State state;
-        int64 num_elements = 0;
-    };
+    // workers beyond it finish their current sub-task and go to sleep
+    void set_num_active_workers(int64 num_active_workers) {
+        ASSERT(num_active_workers > 0, "%ld", num_active_workers);
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->num_active_workers.store(num_active_workers, std::memory_order_relaxed);
+        this->activated.notify_all();
+    }
+
+    // wakes up sleeping workers for good
+    void close() {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->closed = true;
+        this->activated.notify_all();
+    }
 
-    Permutation permutations[2];
+    // returns false once the pool is closed
+    bool wait_until_active(int64 pool_worker_idx) {
+        if (pool_worker_idx < this->num_active_workers.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->activated.wait(lock, [this, pool_worker_idx]() {
+            return this->closed || pool_worker_idx < this->num_active_workers.load(std::memory_order_relaxed);
+        });
+        return !this->closed;
+    }
 };
 
+/**
+ * Draws chunks of a shard: with replacement from the random stream of the column being filled or, in EpochSamplingMode,
+ * from the shared ChunkEpochCursor.
+ */
 struct ChunkSampler {
     const int64 num_chunks;
-    std::mt19937_64 rng;
-
-    ChunkSampler(int64 num_chunks, int32 seed) : num_chunks(num_chunks), rng(seed) {}
+    ChunkEpochCursor *epoch_cursor; // nullptr: chunks are drawn with replacement
+    AliasTable const *alias_table; // nullptr: chunks are drawn uniformly
+    int64 epoch{0}; // epoch of the last chunk returned by next()
+    FeistelPermutation permutation;
+
+    ChunkSampler(int64 num_chunks, ChunkEpochCursor *epoch_cursor, AliasTable const *alias_table)
+            : num_chunks(num_chunks),
+              epoch_cursor(epoch_cursor),
+              alias_table(alias_table),
+              permutation(epoch_cursor ? epoch_cursor->get_permutation(0) : FeistelPermutation(1, 0)) {}
+
+    int64 next(PhiloxStream &rng) {
+        if (this->alias_table) {
+            return this->alias_table->sample(rng());
+        }
+        if (!this->epoch_cursor) {
+            return rng() % num_chunks;
+        }
 
-    int64 next() {
-        return this->rng() % num_chunks;
+        const int64 position = this->epoch_cursor->position.fetch_add(1, std::memory_order_relaxed);
+        if (position / this->num_chunks != this->epoch) {
+            this->epoch = position / this->num_chunks;
+            this->permutation = this->epoch_cursor->get_permutation(this->epoch);
+        }
+        return this->permutation(position % this->num_chunks);
     }
 };
 
+/**
+ * Column of a sub-task being filled by a worker.
+ *
+ * Every column of every filling of a block has its own random stream, keyed by the seed, the column and the block sequence
+ * number, which picks its chunks and the key of the permutation of its rows (element i of the column goes to row
+ * permutation(i)). Reads never span columns, so batches do not depend on
+ * the number of workers, on which worker fills which columns or on the order in which reads complete.
+ */
+struct ColumnCursor {
+    int64 column; // within the sub-task
+    int64 num_elements_left;
+    PhiloxStream rng;
+    FeistelPermutation permutation;
+};
+
 
 class WorkerThread {
-    static const int32 AIO_MAX_BATCH_SIZE = 2048;
+    static const int32 MIN_COMPLETIONS_PER_WAIT = 8;
+    static const int32 DESTINATION_BATCH_SIZE = 64; // destinations computed ahead of the copies of a scatter loop
 
     const int32 thread_idx;
+    const int64 pool_worker_idx; // in the worker pool of the shard
     const TensorDescription tensor_description;
     const SamplerConfig sampler_config;
     const SamplingParameters sampling_params;
 
     WorkQueuePtr work_queue;
+    PoolConcurrency *concurrency;
 
     const int32 file_descriptor;
-    io_context_t io_ctx{nullptr};
-    scoped_array<iocb *> io_requests{new iocb *[AIO_MAX_BATCH_SIZE]};
-    scoped_array<io_event> io_events{new io_event[AIO_MAX_BATCH_SIZE]};
-    scoped_array<byte> read_buffer{nullptr};
+    const int32 queue_depth; // maximum: concurrency may lower it
+    scoped_array<IoCompletion> io_completions;
+    PageBuffer read_buffer;
     scoped_array<ReadDescription> read_descriptions;
+    scoped_array<int32> free_slots;
+
+    // slots of reads prepared together (a submission window), sorted into submission_order before they are sent
+    const SubmissionOrderType submission_order;
+    const StripeGeometry stripe;
+    scoped_array<int32> submission_window;
+    scoped_array<int64> submission_keys; // of slots
+    std::vector<int32> num_device_reads; // in the window, of every member of the RAID-0 array
+
+    std::unique_ptr<IoEngine> io_engine;
+
+    // parts of a row copied into batches and the range of row bytes they span
+    const std::vector<ByteRange> projection;
+    const int64 projection_begin;
+    const int64 projection_end;
+    Memcpy::CopyKernel const &copy_kernel; // copies parts of rows into batch blocks
+    const Memcpy::ScatterFunction fixed_size_scatter; // whole-range loop for single-range projections of common sizes (or nullptr)
+
+    // reduced-precision values: widened to float32 instead of copied (nullptr for float32 values)
+    Dequantize::ConvertKernel const *const convert_kernel;
+    const int64 value_size_b;
+    const std::vector<float> int8_scales; // of every column of a row
+    const std::vector<float> int8_offsets;
+
+    // zero-copy mode: rows are read straight into their slots in the batch block
+    const bool zero_copy;
+    const int32 max_iovecs_per_read;
+    scoped_array<iovec> read_iovecs;
+    scoped_array<byte> discarded_row{nullptr}; // destination of the rows of a read not taken into its column
+
+    // compressed shards: chunks are read whole and decompressed into decompression_buffer before being scattered
+    CompressedContainer const *container;
+    std::unique_ptr<Decompressor> decompressor;
+    scoped_array<byte> decompression_buffer{nullptr};
+    const int64 read_slot_size_b; // part of read_buffer owned by every slot
 
-    LCGPermutationGenerator permutation_generator;
     ChunkSampler chunk_sampler;
 
 public:
+    WorkerCounters counters;
+
     WorkerThread(int32 thread_idx,
+                 int64 pool_worker_idx,
                  TensorDescription const &tensor_description,
                  SamplerConfig const &sampler_config,
                  SamplingParameters const &sampling_params,
-                 int32 file_descriptor,
-                 WorkQueuePtr work_queue)
+                 Shard const &shard,
+                 ChunkEpochCursor *epoch_cursor,
+                 WorkQueuePtr work_queue,
+                 PoolConcurrency *concurrency)
             : thread_idx(thread_idx),
+              pool_worker_idx(pool_worker_idx),
               tensor_description(tensor_description),
               sampler_config(sampler_config),
               sampling_params(sampling_params),
               work_queue(work_queue),
-              file_descriptor(file_descriptor),
-              read_descriptions(new ReadDescription[AIO_MAX_BATCH_SIZE]),
-              permutation_generator(sampling_params.num_batches_in_block, thread_idx),
-              chunk_sampler(sampling_params.num_chunks, thread_idx + sampler_config.seed) {
-        {
+              concurrency(concurrency),
+              file_descriptor(shard.file_descriptor),
+              queue_depth(sampler_config.io_queue_depth),
+              io_completions(new IoCompletion[queue_depth]),
+              read_descriptions(new ReadDescription[queue_depth]),
+              free_slots(new int32[queue_depth]),
+              submission_order(sampler_config.submission_order),
+              stripe(shard.stripe),
+              submission_window(new int32[queue_depth]),
+              submission_keys(new int64[queue_depth]),
+              num_device_reads(shard.stripe.num_devices),
+              projection(get_projection(tensor_description, sampler_config)),
+              projection_begin(get_projection_begin(projection)),
+              projection_end(get_projection_end(projection)),
+              copy_kernel(Memcpy::select_kernel(get_min_range_length(projection))),
+              fixed_size_scatter(projection.size() == 1 && sampler_config.value_format == Float32ValueFormat
+                                 ? copy_kernel.select_scatter(projection.front().length) : nullptr),
+              convert_kernel(Dequantize::select_kernel(sampler_config.value_format)),
+              value_size_b(get_value_size_b(sampler_config.value_format)),
+              int8_scales(get_int8_scales(tensor_description, sampler_config)),
+              int8_offsets(get_int8_offsets(tensor_description, sampler_config)),
+              zero_copy(sampler_config.zero_copy && sampler_config.projection.empty() && !shard.container &&
+                        sampler_config.value_format == Float32ValueFormat && tensor_description.row_size_b % SECTOR_SIZE == 0),
+              max_iovecs_per_read(zero_copy ? sampling_params.max_chunk_size_b / tensor_description.row_size_b + 1 : 0),
+              read_iovecs(new iovec[queue_depth * max_iovecs_per_read]),
+              container(shard.container.get()),
+              read_slot_size_b(container ? container->get_header().max_read_size_b : sampling_params.max_chunk_size_b),
+              chunk_sampler(shard.num_chunks, epoch_cursor, shard.alias_table.get()) {
+        const int64 read_buffer_size = this->zero_copy ? 0 : this->read_slot_size_b * queue_depth;
+        if (read_buffer_size > 0) {
+            this->read_buffer = PageBuffer(read_buffer_size, sampler_config.huge_pages, "read buffer");
+
+            // before io_uring pins the buffer and before it's touched
+            if (shard.numa_node != Numa::UNKNOWN_NODE && !Numa::bind_memory(this->read_buffer.get(), read_buffer_size, shard.numa_node)) {
+                LOG("Failed to bind read buffer to NUMA node " << shard.numa_node << "; errno: " << errno);
+            }
+            if (sampler_config.lock_memory) {
+                this->read_buffer.lock("read buffer");
+            }
+        }
+
+        if (this->zero_copy) {
             byte *tmp_buf;
-            CHECK_SYSCALL(
-                    ::posix_memalign((void **) &tmp_buf, PAGE_SIZE, sampling_params.max_chunk_size_b * AIO_MAX_BATCH_SIZE) == 0,
-                    "posix_memalign failed"
-            );
-            read_buffer.reset(tmp_buf);
+            CHECK_SYSCALL(::posix_memalign((void **) &tmp_buf, PAGE_SIZE, tensor_description.row_size_b) == 0, "posix_memalign failed");
+            this->discarded_row.reset(tmp_buf);
+        }
+
+        if (this->container) {
+            byte *tmp_buf;
+            CHECK_SYSCALL(::posix_memalign((void **) &tmp_buf, PAGE_SIZE, sampling_params.chunk_size_b) == 0, "posix_memalign failed");
+            this->decompression_buffer.reset(tmp_buf);
+            this->decompressor.reset(new Decompressor(static_cast<CompressionCodecType>(this->container->get_header().codec)));
         }
 
         ASSERT(this->file_descriptor >= 0, "invalid file_descriptior: %d", this->file_descriptor);
-        CHECK_SYSCALL(::io_setup(AIO_MAX_BATCH_SIZE, &io_ctx) == 0, "Failed to setup aio context");
+        this->io_engine = create_io_engine(
+                sampler_config.io_engine,
+                this->file_descriptor,
+                this->queue_depth,
+                Buffer{.size = read_buffer_size, .buffer = this->read_buffer.get()}
+        );
+    }
 
-        for (int j = 0; j < AIO_MAX_BATCH_SIZE; ++j) {
-            io_requests[j] = new iocb;
-        }
+    Memcpy::CopyKernel const &get_copy_kernel() const {
+        return this->copy_kernel;
+    }
+
+    Dequantize::ConvertKernel const *get_convert_kernel() const {
+        return this->convert_kernel;
+    }
+
+    PageBuffer const &get_read_buffer() const {
+        return this->read_buffer;
     }
 
     WorkerThread(const WorkerThread &other) = delete;
@@ -152,106 +392,247 @@ public:
 
     WorkerThread(WorkerThread &&o) = default;
 
-    ~WorkerThread() {
-        CHECK_SYSCALL(io_destroy(this->io_ctx) == 0, "Failed to destroy aio context");
-
-        for (int j = 0; j < AIO_MAX_BATCH_SIZE; ++j) {
-            delete io_requests[j];
-        }
-    }
-
     void operator()() {
         for (;;) {
-            SubTaskPtr sub_task;
-            if (!work_queue->pop(sub_task)) {
+            if (!this->concurrency->wait_until_active(this->pool_worker_idx)) {
                 return; // close requested
             }
 
-            if (sub_task->type == ReadBatchBlockTaskType) {
-                auto &sub_task_downcast = *dynamic_cast<ReadBatchBlockSubTask *>(sub_task.get());
-
-                if (this->tensor_description.row_size_b % 32 == 0 && this->tensor_description.row_size_b >= 1024) {
-                    CASSERT((intptr_t(sub_task_downcast.parent_task->block->buffer.buffer) & 31) == 0, "Unaligned buffer");
-                    read_block<true>(sub_task_downcast);
-                } else {
-                    read_block<false>(sub_task_downcast);
-                }
+            ReadBatchBlockSubTask *sub_task;
+            const int64 wait_start_ns = monotonic_time_ns();
+            this->counters.idle_since_ns.set(wait_start_ns);
+            if (!work_queue->pop(sub_task)) {
+                return; // close requested
             }
+            this->counters.idle_ns.add(monotonic_time_ns() - wait_start_ns);
+            this->counters.idle_since_ns.set(0);
+
+            this->read_block(*sub_task);
         }
     }
 
-    template<bool use_alternative_memcpy>
     void read_block(ReadBatchBlockSubTask &sub_task) {
         int64 const element_size = this->tensor_description.row_size_b;
-        int64 num_elements_to_read = sub_task.parent_task->block->num_samples / sub_task.parent_task->num_sub_tasks;
-
-        RawLCG::State permutation(std::move(this->permutation_generator.start_new_permutation()));
-        int64 num_elements_left_in_column = this->sampling_params.num_batches_in_block;
-        int64 target_column = 0;
-
-        while (num_elements_to_read > 0) {
-            // prepare new requests
-            int64 num_pending_requests = 0;
-
-            for (int req_idx = 0; req_idx < AIO_MAX_BATCH_SIZE && num_elements_to_read > 0; ++req_idx) {
-                this->read_descriptions[req_idx] = std::move(create_read_description(
-                        element_size, num_elements_to_read, permutation, num_elements_left_in_column, target_column
-                ));
-                ::io_prep_pread(
-                        this->io_requests[req_idx],
-                        this->file_descriptor,
-                        this->read_buffer.get() + req_idx * this->sampling_params.max_chunk_size_b,
-                        static_cast<size_t>(this->read_descriptions[req_idx].read_size),
-                        this->read_descriptions[req_idx].read_offset
-                );
-                io_requests[req_idx]->data = &this->read_descriptions[req_idx];
-                num_pending_requests++;
+        ColumnCursor column = this->start_column(sub_task, 0);
+
+        // every slot owns a part of read_buffer; slots are refilled as soon as their reads complete, so the device sees
+        // queue_depth (or as many as concurrency allows) outstanding requests until the sub-task runs out of elements to read
+        int32 num_free_slots = this->queue_depth;
+        for (int32 slot = 0; slot < this->queue_depth; ++slot) {
+            this->free_slots[slot] = slot;
+        }
+        int64 num_pending_requests = 0;
+        int64 first_epoch = -1;
+
+        int64 now_ns = monotonic_time_ns();
+
+        while (column.column < sub_task.num_columns || num_pending_requests > 0) {
+            // refill free slots (reads are drawn in the same order whatever the submission order, so batches do not change)
+            int32 num_submitted = 0;
+            const int32 min_free_slots = this->queue_depth - std::min(this->concurrency->get_queue_depth(), this->queue_depth);
+            while (num_free_slots > min_free_slots && column.column < sub_task.num_columns) {
+                const int32 slot = this->free_slots[--num_free_slots];
+                ReadDescription &read_description = this->read_descriptions[slot];
+                read_description = std::move(create_read_description(sub_task, element_size, column));
+                read_description.slot = slot;
+                read_description.submit_time_ns = now_ns;
+                if (first_epoch < 0) {
+                    first_epoch = this->chunk_sampler.epoch;
+                }
+                this->submission_window[num_submitted++] = slot;
             }
+            this->order_submission_window(num_submitted);
 
-            // send them
-            DASSERT(num_pending_requests > 0, "%ld", num_pending_requests);
-            if (::io_submit(this->io_ctx, num_pending_requests, this->io_requests.get()) != num_pending_requests) {
-                ERROR("io_submit() failed");
+            for (int32 window_idx = 0; window_idx < num_submitted; ++window_idx) {
+                ReadDescription &read_description = this->read_descriptions[this->submission_window[window_idx]];
+                const int32 slot = read_description.slot;
+                if (this->zero_copy) {
+                    this->prep_direct_read(sub_task, read_description);
+                } else {
+                    read_description.buffer = this->read_buffer.get() + slot * this->read_slot_size_b;
+                    this->io_engine->prep_read(
+                            slot, read_description.buffer, read_description.read_size, read_description.read_offset, &read_description
+                    );
+                }
             }
+            num_pending_requests += num_submitted;
+            this->counters.reads_submitted.add(num_submitted);
 
-            // wait for all of them
-            while (num_pending_requests > 0) {
-                timespec timeout{.tv_sec = 0, .tv_nsec =100000000};
-                int32 num_events = ::io_getevents(
-                        this->io_ctx,
-                        std::min(10L, num_pending_requests),
-                        std::min(num_pending_requests, 128L),
-                        this->io_events.get(),
-                        &timeout
-                );
-                CHECK_SYSCALL(num_events >= 0, "io_getevents() failed: num_events: " << num_events);
+            // send them
+            DASSERT(num_pending_requests > 0, "%ld", num_pending_requests);
+            const int64 submit_start_ns = monotonic_time_ns();
+            this->io_engine->submit();
+
+            // wait for some of them
+            int32 num_events = this->io_engine->wait(
+                    std::min(static_cast<int64>(MIN_COMPLETIONS_PER_WAIT), num_pending_requests),
+                    static_cast<int32>(num_pending_requests),
+                    this->io_completions.get()
+            );
+            const int64 completion_time_ns = monotonic_time_ns();
+            this->counters.io_wait_ns.add(completion_time_ns - submit_start_ns);
+            int64 decompress_ns = 0;
 
-                for (int32 event_idx = 0; event_idx < num_events; ++event_idx) {
-                    io_event &event = this->io_events[event_idx];
-                    ReadDescription *read_description = reinterpret_cast<ReadDescription *>(event.data);
+            for (int32 event_idx = 0; event_idx < num_events; ++event_idx) {
+                IoCompletion &completion = this->io_completions[event_idx];
+                ReadDescription *read_description = reinterpret_cast<ReadDescription *>(completion.data);
 
-                    ERROR_ON(int64(event.res) != read_description->read_size,
-                             "Incomplete read. Expected: %ld; got: %ld; offset=%ld (idx: %ld)",
-                             read_description->read_size, event.res, read_description->read_offset, read_description->chunk_idx
-                    );
-                    this->handle_finished_read<use_alternative_memcpy>(sub_task, *read_description, static_cast<byte *>(event.obj->u.c.buf));
+                ERROR_ON(completion.result != read_description->read_size,
+                         "Incomplete read. Expected: %ld; got: %ld; offset=%ld (idx: %ld)",
+                         read_description->read_size, completion.result, read_description->read_offset, read_description->chunk_idx
+                );
+                this->counters.io_latency.record(completion_time_ns - read_description->submit_time_ns);
+                this->counters.bytes_read.add(read_description->read_size);
+                this->counters.bytes_wasted.add(read_description->read_size - this->get_bytes_used(*read_description));
+                this->counters.samples_read.add(read_description->num_elements);
+
+                if (this->container) {
+                    const int64 decompress_start_ns = monotonic_time_ns();
+                    byte const *rows = this->decompress_chunk(*read_description);
+                    decompress_ns += monotonic_time_ns() - decompress_start_ns;
+                    this->handle_finished_read(sub_task, *read_description, rows);
+                } else if (!this->zero_copy) {
+                    this->handle_finished_read(sub_task, *read_description, read_description->buffer);
                 }
-                num_pending_requests -= num_events;
+                this->free_slots[num_free_slots++] = read_description->slot;
             }
+            num_pending_requests -= num_events;
+            this->counters.reads_completed.add(num_events);
+
+            now_ns = monotonic_time_ns();
+            this->counters.scatter_ns.add(now_ns - completion_time_ns - decompress_ns);
+            this->counters.decompress_ns.add(decompress_ns);
         }
 
-        sub_task.parent_task->mark_sub_task_as_done();
+        sub_task.parent_task->mark_sub_task_as_done(first_epoch);
     }
 
 private:
-    ReadDescription create_read_description(const int64 element_size,
-                                            int64 &num_elements_to_read,
-                                            RawLCG::State &permutation,
-                                            int64 &num_elements_left_in_column,
-                                            int64 &target_column) {
-        ASSERT(num_elements_to_read > 0, "%ld", num_elements_to_read);
-
-        const int64 chunk_idx = this->chunk_sampler.next();
+    static std::vector<ByteRange> get_projection(TensorDescription const &tensor_description, SamplerConfig const &sampler_config) {
+        if (sampler_config.projection.empty()) {
+            return {ByteRange{.offset = 0, .length = tensor_description.row_size_b}};
+        }
+        return sampler_config.projection;
+    }
+
+    static std::vector<float> get_int8_scales(TensorDescription const &tensor_description, SamplerConfig const &sampler_config) {
+        if (sampler_config.value_format != Int8ValueFormat || !sampler_config.int8_scales.empty()) {
+            return sampler_config.int8_scales;
+        }
+        return std::vector<float>(tensor_description.row_size_b, 1.0f);
+    }
+
+    static std::vector<float> get_int8_offsets(TensorDescription const &tensor_description, SamplerConfig const &sampler_config) {
+        if (sampler_config.value_format != Int8ValueFormat || !sampler_config.int8_offsets.empty()) {
+            return sampler_config.int8_offsets;
+        }
+        return std::vector<float>(tensor_description.row_size_b, 0.0f);
+    }
+
+    static int64 get_projection_begin(std::vector<ByteRange> const &projection) {
+        int64 begin = projection.front().offset;
+        for (auto const &range : projection) {
+            begin = std::min(begin, range.offset);
+        }
+        return begin;
+    }
+
+    static int64 get_projection_end(std::vector<ByteRange> const &projection) {
+        int64 end = 0;
+        for (auto const &range : projection) {
+            end = std::max(end, range.offset + range.length);
+        }
+        return end;
+    }
+
+    // streaming scatter loops store whole vectors: every destination row must be aligned (batch blocks are page-aligned)
+    bool can_use_fixed_size_scatter(ReadBatchBlockSubTask const &sub_task) const {
+        if (!this->fixed_size_scatter) {
+            return false;
+        }
+        byte const *const batch_block = sub_task.parent_task->block->buffer.buffer;
+        const auto first_destination = reinterpret_cast<uintptr_t>(batch_block + sub_task.first_column * this->sampling_params.output_row_size_b);
+        return ((first_destination | this->sampling_params.batch_size_b | this->sampling_params.output_row_size_b) &
+                (Memcpy::SCATTER_ALIGNMENT - 1)) == 0;
+    }
+
+    static int64 get_min_range_length(std::vector<ByteRange> const &projection) {
+        int64 length = projection.front().length;
+        for (auto const &range : projection) {
+            length = std::min(length, range.length);
+        }
+        return length;
+    }
+
+    // sorts the window by read offset; with a known stripe geometry the k-th reads (by offset) of all members of the array go
+    // before their (k+1)-th reads, so io_submit() does not stall on one member while the others are idle
+    void order_submission_window(int32 num_reads) {
+        if (this->submission_order == RandomSubmissionOrder || num_reads < 2) {
+            return;
+        }
+
+        int32 *const window = this->submission_window.get();
+        int64 *const keys = this->submission_keys.get();
+        ReadDescription const *const read_descriptions = this->read_descriptions.get();
+        std::sort(window, window + num_reads, [read_descriptions](int32 slot_a, int32 slot_b) {
+            return read_descriptions[slot_a].read_offset < read_descriptions[slot_b].read_offset;
+        });
+        if (this->stripe.num_devices <= 1) {
+            return;
+        }
+
+        std::fill(this->num_device_reads.begin(), this->num_device_reads.end(), 0);
+        for (int32 window_idx = 0; window_idx < num_reads; ++window_idx) {
+            const int32 slot = window[window_idx];
+            const int64 device = read_descriptions[slot].read_offset / this->stripe.stripe_size_b % this->stripe.num_devices;
+            keys[slot] = this->num_device_reads[device]++ * this->stripe.num_devices + device;
+        }
+        std::stable_sort(window, window + num_reads, [keys](int32 slot_a, int32 slot_b) {
+            return keys[slot_a] < keys[slot_b];
+        });
+    }
+
+    ColumnCursor start_column(ReadBatchBlockSubTask const &sub_task, int64 column) const {
+        ColumnCursor cursor{
+                .column = column,
+                .num_elements_left = this->sampling_params.num_batches_in_block,
+                .rng = PhiloxStream(this->sampler_config.seed, sub_task.first_column + column, sub_task.parent_task->block->sequence_number),
+                .permutation = {}
+        };
+        cursor.permutation = FeistelPermutation(this->sampling_params.num_batches_in_block, cursor.rng());
+        return cursor;
+    }
+
+    // the next chunk of the column; moves the cursor to the next column once the read fills the current one
+    ReadDescription create_read_description(ReadBatchBlockSubTask const &sub_task, const int64 element_size, ColumnCursor &column) {
+        ASSERT(column.num_elements_left > 0, "%ld", column.num_elements_left);
+
+        const int64 chunk_idx = this->chunk_sampler.next(column.rng);
+        ReadDescription read_description = this->container
+                                           ? this->locate_compressed_chunk(chunk_idx, column.num_elements_left)
+                                           : this->locate_chunk(chunk_idx, element_size, column.num_elements_left);
+        if (read_description.num_elements < read_description.num_read_elements) {
+            // the last read of the column takes the rows following a random one (wrapping around), so that every row of
+            // the chunk is taken equally often
+            read_description.first_element = static_cast<int64>(column.rng() % read_description.num_read_elements);
+        }
+        read_description.target_column = column.column;
+        read_description.permutation = column.permutation;
+        read_description.permutation_offset = this->sampling_params.num_batches_in_block - column.num_elements_left;
+
+        // the permutation is indexed directly, so the next read of the column just starts at a later index
+        column.num_elements_left -= read_description.num_elements;
+        if (column.num_elements_left == 0 && column.column + 1 < sub_task.num_columns) {
+            column = this->start_column(sub_task, column.column + 1);
+        } else if (column.num_elements_left == 0) {
+            ++column.column; // the sub-task is done
+        }
+
+        return read_description;
+    }
+
+    // sector-aligned read of the rows starting in a raw chunk (at most num_elements_to_read of them are taken)
+    ReadDescription locate_chunk(const int64 chunk_idx, const int64 element_size, const int64 num_elements_to_read) {
         int64 read_start = chunk_idx * sampling_params.chunk_size_b;
         int64 read_end = read_start + sampling_params.chunk_size_b;
         int64 data_size_b = read_end - read_start;
@@ -270,72 +651,216 @@ private:
             data_size_b += add;
         }
 
-        const int64 read_size_b = read_end - read_start;
-        const int64 data_offset = read_start % element_size == 0 ? 0 : element_size - read_start % element_size;
-        const int64 num_chunk_elements = (data_size_b) / element_size;
-        int64 num_perm_elements = std::min(num_elements_left_in_column, num_chunk_elements);
-        num_elements_left_in_column -= num_perm_elements;
+        int64 data_offset = read_start % element_size == 0 ? 0 : element_size - read_start % element_size;
+        int64 num_chunk_elements = (data_size_b) / element_size;
 
-        ReadDescription read_description{
+        // skip leading and trailing sectors holding only bytes outside of the projection
+        const int64 trimmed_read_start = align_down(read_start + data_offset + this->projection_begin, SECTOR_SIZE);
+        read_end = std::min(read_end, align_up(read_start + data_offset + (num_chunk_elements - 1) * element_size + this->projection_end, SECTOR_SIZE));
+        data_offset -= trimmed_read_start - read_start;
+        read_start = trimmed_read_start;
+
+        return ReadDescription{
                 .chunk_idx = chunk_idx,
                 .read_offset = read_start,
-                .read_size = read_size_b,
+                .read_size = read_end - read_start,
                 .data_offset = data_offset,
-                .num_elements = num_chunk_elements,
-                .target_column = target_column,
-                .permutations = {
-                        {.state = permutation, .num_elements = num_perm_elements}
-                }
+                .num_elements = std::min(num_chunk_elements, num_elements_to_read),
+                .num_read_elements = num_chunk_elements,
+                .first_element = 0,
+                .target_column = 0,
+                .compressed_size_b = 0,
+                .permutation = {},
+                .permutation_offset = 0
         };
+    }
 
-        if (num_elements_left_in_column == 0) { // column filled up - start a new permutation
-            permutation = std::move(permutation_generator.start_new_permutation());
-            num_elements_left_in_column = sampling_params.num_batches_in_block;
-            num_perm_elements = num_chunk_elements - num_perm_elements;
-            DASSERT(num_elements_left_in_column > num_perm_elements, "batch_size too small?");
-            num_elements_left_in_column -= num_perm_elements;
-            ++target_column;
-            ASSERT(target_column <= this->sampler_config.max_batch_elements, "%ld", target_column);
-            read_description.permutations[1] = {.state = permutation, .num_elements = num_perm_elements};
-        }
+    // compressed chunks are read and decompressed whole (at most num_elements_to_read rows are taken)
+    ReadDescription locate_compressed_chunk(const int64 chunk_idx, const int64 num_elements_to_read) {
+        ChunkIndexEntry const &chunk = this->container->get_chunk(chunk_idx);
+        const int64 num_chunk_rows = this->container->get_num_chunk_rows(chunk_idx);
 
-        if (num_perm_elements > 0) {
-            RawLCG::skip(permutation, num_perm_elements);
+        return ReadDescription{
+                .chunk_idx = chunk_idx,
+                .read_offset = chunk.offset,
+                .read_size = align_up(chunk.compressed_size_b, SECTOR_SIZE),
+                .data_offset = 0,
+                .num_elements = std::min(num_chunk_rows, num_elements_to_read),
+                .num_read_elements = num_chunk_rows,
+                .first_element = 0,
+                .target_column = 0,
+                .compressed_size_b = chunk.compressed_size_b,
+                .permutation = {},
+                .permutation_offset = 0
+        };
+    }
+
+    // bytes of the read that end up in the batch block (for compressed chunks: their share of the compressed size)
+    int64 get_bytes_used(ReadDescription const &read_description) const {
+        if (this->container) {
+            return read_description.compressed_size_b * read_description.num_elements / this->container->get_num_chunk_rows(read_description.chunk_idx);
         }
+        return read_description.num_elements * this->sampling_params.output_row_size_b;
+    }
 
-        num_elements_to_read -= num_chunk_elements;
+    byte const *decompress_chunk(ReadDescription const &read_description) {
+        const int64 chunk_size_b = this->container->get_num_chunk_rows(read_description.chunk_idx) * this->tensor_description.row_size_b;
+        const int64 decompressed_size_b = this->decompressor->decompress(
+                read_description.buffer, read_description.compressed_size_b, this->decompression_buffer.get(), chunk_size_b
+        );
+        ERROR_ON(decompressed_size_b != chunk_size_b, "Corrupted chunk %ld: decompressed %ld bytes, expected %ld",
+                 read_description.chunk_idx, decompressed_size_b, chunk_size_b);
+        return this->decompression_buffer.get();
+    }
 
-        return read_description;
+    // calls fun(first_element_idx, destinations, num_elements, num_destinations) for consecutive batches of the read's elements;
+    // destinations[num_elements, num_destinations) are the first destinations of the next batch (to prefetch them)
+    template<typename Fun>
+    void for_each_destination_batch(ReadBatchBlockSubTask const &sub_task, ReadDescription const &read_description, Fun &&fun) {
+        FeistelPermutation const &permutation = read_description.permutation;
+        byte *const batch_block = sub_task.parent_task->block->buffer.buffer;
+        int64 const batch_size_b = this->sampling_params.batch_size_b;
+        int64 const element_size_b = this->sampling_params.output_row_size_b;
+        byte *const column = batch_block + (sub_task.first_column + read_description.target_column) * element_size_b;
+        int64 const num_elements = read_description.num_elements;
+
+        // checked once per read: the elements are not checked one by one outside of debug builds
+        ASSERT(read_description.permutation_offset >= 0 && read_description.permutation_offset + num_elements <= permutation.get_size(),
+               "permutation_offset: %ld; num_elements: %ld; size: %ld", read_description.permutation_offset, num_elements,
+               permutation.get_size());
+
+        byte *destinations[DESTINATION_BATCH_SIZE + Memcpy::PREFETCH_DISTANCE];
+        int32 num_destinations = 0; // computed, starting at first_element_idx
+        for (int64 first_element_idx = 0; first_element_idx < num_elements; first_element_idx += DESTINATION_BATCH_SIZE) {
+            const int32 max_destinations = static_cast<int32>(std::min<int64>(
+                    DESTINATION_BATCH_SIZE + Memcpy::PREFETCH_DISTANCE, num_elements - first_element_idx));
+            for (; num_destinations < max_destinations; ++num_destinations) {
+                const int64 element_idx = first_element_idx + num_destinations;
+                destinations[num_destinations] = column + permutation(read_description.permutation_offset + element_idx) * batch_size_b;
+            }
+
+            const int32 batch_elements = std::min(static_cast<int32>(DESTINATION_BATCH_SIZE), num_destinations);
+            fun(static_cast<int32>(first_element_idx), destinations, batch_elements, num_destinations);
+
+            std::copy(destinations + batch_elements, destinations + num_destinations, destinations);
+            num_destinations -= batch_elements;
+        }
     }
 
-    template<bool use_alternative_memcpy>
-    void handle_finished_read(ReadBatchBlockSubTask &sub_task, ReadDescription &read_description, byte const *read_data) {
-        auto &permutation = read_description.permutations[0];
-        int64 target_column = read_description.target_column;
+    // calls fun(element_idx, destination) for every element of the read, in file order
+    template<typename Fun>
+    void for_each_destination(ReadBatchBlockSubTask const &sub_task, ReadDescription const &read_description, Fun &&fun) {
+        FeistelPermutation const &permutation = read_description.permutation;
         byte *const batch_block = sub_task.parent_task->block->buffer.buffer;
         int64 const batch_size_b = this->sampling_params.batch_size_b;
-        int64 const sub_task_offset = batch_size_b / sub_task.parent_task->num_sub_tasks * sub_task.sub_task_id;
+        int64 const element_size_b = this->sampling_params.output_row_size_b;
+        byte *const column = batch_block + (sub_task.first_column + read_description.target_column) * element_size_b;
+
+        for (int32 element_idx = 0; element_idx < read_description.num_elements; ++element_idx) {
+            fun(element_idx, column + permutation(read_description.permutation_offset + element_idx) * batch_size_b);
+        }
+    }
+
+    // zero-copy read: every row of the chunk goes straight to its destination (rows are whole sectors, so no padding is read);
+    // rows not taken into the column all go to discarded_row
+    void prep_direct_read(ReadBatchBlockSubTask const &sub_task, ReadDescription &read_description) {
         int64 const element_size_b = this->tensor_description.row_size_b;
+        int64 const num_read_elements = read_description.num_read_elements;
+        int64 const first_element = read_description.first_element;
+        iovec *iovecs = this->read_iovecs.get() + read_description.slot * this->max_iovecs_per_read;
+
+        DASSERT(read_description.data_offset == 0 && read_description.read_size == num_read_elements * element_size_b,
+                "read is not row-aligned: data_offset: %ld; read_size: %ld", read_description.data_offset, read_description.read_size);
+        DASSERT(num_read_elements <= this->max_iovecs_per_read, "%ld", num_read_elements);
+
+        for (int64 element_idx = read_description.num_elements; element_idx < num_read_elements; ++element_idx) {
+            iovecs[(first_element + element_idx) % num_read_elements] = iovec{
+                    .iov_base = this->discarded_row.get(), .iov_len = static_cast<size_t>(element_size_b)
+            };
+        }
+        this->for_each_destination(sub_task, read_description, [=](int32 element_idx, byte *dst) {
+            iovecs[(first_element + element_idx) % num_read_elements] = iovec{.iov_base = dst, .iov_len = static_cast<size_t>(element_size_b)};
+        });
 
-        DASSERT(read_description.data_offset >= 0, "%ld", read_description.data_offset);
-        DASSERT(read_description.permutations[0].num_elements + read_description.permutations[1].num_elements == read_description.num_elements,
-                "Invalid read description"
+        read_description.buffer = nullptr;
+        this->io_engine->prep_readv(
+                read_description.slot, iovecs, static_cast<int32>(num_read_elements), read_description.read_offset, &read_description
         );
+    }
+
+    // scatter of reduced-precision rows: every range is widened to float32 straight into the batch block
+    void convert_read(ReadBatchBlockSubTask const &sub_task, ReadDescription const &read_description, byte const *read_data) {
+        int64 const element_size_b = this->tensor_description.row_size_b;
+        int64 const value_size_b = this->value_size_b;
+        std::vector<ByteRange> const &projection = this->projection;
+        Dequantize::ConvertFunction const convert = this->convert_kernel->convert;
+        float const *const scales = this->int8_scales.empty() ? nullptr : this->int8_scales.data();
+        float const *const offsets = this->int8_offsets.empty() ? nullptr : this->int8_offsets.data();
+
+        this->for_each_destination(sub_task, read_description, [=, &projection](int32 element_idx, byte *dst) {
+            byte const *row = read_data + element_size_b * element_idx;
+            float *values = reinterpret_cast<float *>(dst);
+            for (auto const &range : projection) {
+                const int64 first_column = range.offset / value_size_b;
+                const int64 num_values = range.length / value_size_b;
+                convert(values, row + range.offset, num_values, scales ? scales + first_column : nullptr, offsets ? offsets + first_column : nullptr);
+                values += num_values;
+            }
+        });
+    }
+
+    void handle_finished_read(ReadBatchBlockSubTask const &sub_task, ReadDescription const &read_description, byte const *read_data) {
+        int64 const element_size_b = this->tensor_description.row_size_b;
+
+        DASSERT(read_description.data_offset + this->projection_begin >= 0, "%ld", read_description.data_offset);
 
         read_data += read_description.data_offset;
 
-        for (int32 element_idx = 0; element_idx < read_description.num_elements; ++element_idx) {
-            if (permutation.num_elements == 0) {
-                permutation = read_description.permutations[1];
-                ++target_column;
+        if (read_description.first_element == 0) {
+            this->scatter_rows(sub_task, read_description, read_data);
+        } else {
+            // the taken rows wrap around the end of the read: the two runs are scattered separately
+            ReadDescription run = read_description;
+            run.num_elements = std::min(read_description.num_elements, read_description.num_read_elements - read_description.first_element);
+            this->scatter_rows(sub_task, run, read_data + element_size_b * read_description.first_element);
+            if (run.num_elements < read_description.num_elements) {
+                run.permutation_offset += run.num_elements;
+                run.num_elements = read_description.num_elements - run.num_elements;
+                this->scatter_rows(sub_task, run, read_data);
             }
+        }
+
+        if (this->copy_kernel.non_temporal && !this->convert_kernel) {
+            Memcpy::store_fence(); // before the read slot is reused and the block is handed over
+        }
+    }
 
-            byte *dst = batch_block + sub_task_offset + target_column * element_size_b + permutation.state.element * batch_size_b;
-            byte const *src = read_data + element_size_b * element_idx;
-            smart_memcpy<use_alternative_memcpy>(dst, src, element_size_b);
+    // scatters the first num_elements rows of read_data
+    void scatter_rows(ReadBatchBlockSubTask const &sub_task, ReadDescription const &read_description, byte const *read_data) {
+        int64 const element_size_b = this->tensor_description.row_size_b;
+        std::vector<ByteRange> const &projection = this->projection;
+        Memcpy::CopyFunction const copy = this->copy_kernel.copy;
 
-            RawLCG::next(permutation.state);
-            --permutation.num_elements;
+        if (this->convert_kernel) {
+            this->convert_read(sub_task, read_description, read_data);
+            return;
+        }
+
+        if (this->can_use_fixed_size_scatter(sub_task)) {
+            Memcpy::ScatterFunction const scatter = this->fixed_size_scatter;
+            byte const *rows = read_data + projection.front().offset;
+            this->for_each_destination_batch(sub_task, read_description, [rows, element_size_b, scatter](
+                    int32 first_element_idx, byte *const *destinations, int32 num_elements, int32 num_destinations) {
+                scatter(destinations, rows + element_size_b * first_element_idx, element_size_b, num_elements, num_destinations);
+            });
+        } else {
+            this->for_each_destination(sub_task, read_description, [read_data, element_size_b, &projection, copy](int32 element_idx, byte *dst) {
+                byte const *row = read_data + element_size_b * element_idx;
+                for (auto const &range : projection) {
+                    copy(dst, row + range.offset, range.length);
+                    dst += range.length;
+                }
+            });
         }
     }
 };
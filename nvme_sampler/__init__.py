@@ -1,46 +1,386 @@
+import asyncio
 import cffi
+import mmap
 import torch
 import random
+import warnings
 
 from ._ext import native_sampler as lib
 
+WORKER_STATS_FIELDS = [
+    "reads_submitted", "reads_completed", "bytes_read", "bytes_wasted", "samples_read", "io_wait_ns", "scatter_ns", "decompress_ns",
+    "idle_ns", "io_latency_p50_ns", "io_latency_p90_ns", "io_latency_p99_ns", "io_latency_p999_ns",
+]
 
-class NvmeSampler(object):
-    def __init__(self, file_path, num_rows, row_size_b, max_batch_elements, max_num_threads=8, memory_usage_limit_b=8 * 2 ** 30, seed=None):
+CONSUMER_STATS_FIELDS = ["num_consumers", "blocks_consumed", "batches_consumed", "samples_consumed", "consumer_wait_ns"]
+
+MEMORY_STATS_FIELDS = ["batch_blocks_page_size_b", "read_buffers_page_size_b", "locked_memory_b"]
+
+CONCURRENCY_STATS_FIELDS = ["num_active_workers", "io_queue_depth"]
+
+IO_ENGINES = {
+    "libaio": 0,
+    "io_uring": 1,
+    "io_uring_sqpoll": 2,
+}
+
+SAMPLING_MODES = {
+    "random": 0,
+    "epoch": 1,
+}
+
+STORAGE_FORMATS = {
+    "raw": 0,
+    "compressed": 1,
+}
+
+HUGE_PAGES = {
+    "none": 0,
+    "thp": 1,
+    "2m": 2,
+    "1g": 3,
+}
+
+VALUE_FORMATS = {
+    "float32": (0, 4),
+    "float16": (1, 2),
+    "bfloat16": (2, 2),
+    "int8": (3, 1),
+}
+
+SUBMISSION_ORDERS = {
+    "random": 0,
+    "offset": 1,
+    "stripe": 2,
+}
+
+NUMA_POLICIES = {
+    "none": 0,
+    "local": 1,
+}
+
+
+class BatchReader(object):
+    """
+    Batch reading methods of a sampler consumer (see NvmeSampler.create_consumer); a consumer must be used by one thread
+    at a time.
+    """
+
+    def read_batch(self, batch_size):
+        """
+        Reads next batch.
+
+        :param batch_size must be smaller than max_batch_elements
+        """
+        offset = lib.read_batch(self.handle, self.consumer, batch_size)
+        if offset < 0:
+            raise Exception("Failed to read data")
+
+        return self._batch(offset, batch_size)
+
+    def lease_batch(self, batch_size):
+        """
+        Like read_batch, but the returned tensor stays valid until release_batch(tensor) (read_batch tensors are overwritten
+        once the sampler moves past their batch block). Leased batches keep their blocks from being refilled, so they
+        should come from fewer than num_batch_blocks - 1 blocks at a time.
+        """
+        offset = lib.lease_batch(self.handle, self.consumer, batch_size)
+        if offset < 0:
+            raise Exception("Failed to read data")
+
+        return self._batch(offset, batch_size)
+
+    def release_batch(self, batch):
+        """
+        Releases a tensor returned by lease_batch; may be called from any thread.
+        """
+        lib.release_batch(self.handle, batch.storage_offset())
+
+    def try_read_batch(self, batch_size):
+        """
+        Non-blocking read_batch: returns None if the next batch needs a batch block that workers have not filled yet.
+        """
+        offset = lib.try_read_batch(self.handle, self.consumer, batch_size)
+        if offset < 0:
+            return None
+
+        return self._batch(offset, batch_size)
+
+    async def read_batch_async(self, batch_size, loop=None):
+        """
+        read_batch for asyncio: waits for a batch block on ready_fd in the event loop instead of blocking it.
+        """
+        loop = loop or asyncio.get_event_loop()
+        batch = self.try_read_batch(batch_size)
+        while batch is None:
+            ready = loop.create_future()
+            loop.add_reader(self.ready_fd, lambda: ready.done() or ready.set_result(None))
+            try:
+                await ready
+            finally:
+                loop.remove_reader(self.ready_fd)
+            batch = self.try_read_batch(batch_size)
+        return batch
+
+    @property
+    def ready_fd(self):
+        """
+        File descriptor (eventfd) readable while a batch may be ready (a filled batch block is waiting or the block being
+        read has batches left); use it with select/poll/epoll or an event loop: call try_read_batch until it returns None,
+        then wait until ready_fd is readable. Do not read or close it.
+        """
+        return lib.get_ready_fd(self.handle)
+
+    def _batch(self, offset, batch_size):
+        return self.buffer[offset: offset + batch_size * self.row_size].view(batch_size, self.row_size_b // 4)
+
+
+class NvmeSampler(BatchReader):
+    def __init__(self, file_path, num_rows, row_size_b, max_batch_elements, max_num_threads=8, memory_usage_limit_b=8 * 2 ** 30, seed=None,
+                 io_engine="libaio", io_queue_depth=512, num_batch_blocks=2, zero_copy=True,
+                 numa_policy="none", sampling_mode="random",
+                 weights_path=None, projection=None, storage_format="raw", huge_pages="none", lock_memory=False, checkpoint=None,
+                 value_format="float32", int8_scales=None, int8_offsets=None,
+                 submission_order="random", stripe_size_b=0, num_stripe_devices=0, auto_tune=False):
         """
+        :param file_path: path of the dataset file or a list of paths of dataset shards (e.g. one file per NVMe drive);
+            rows of shards are concatenated in the given order and each shard gets its own worker threads
         :param row_size_b: sample size in bytes
         :param max_batch_elements must be greater or equal to any batch_size param passed read_batch
+        :param seed: batches read from a sampler (by a single consumer) depend only on the seed, not on max_num_threads,
+            io_engine or io_queue_depth ("random" sampling mode); None: a random seed (the seed of checkpoint if it is given)
+        :param io_engine: one of "libaio", "io_uring", "io_uring_sqpoll"; io_uring falls back to libaio if it is not supported
+        :param io_queue_depth: number of reads each worker thread keeps in flight
+        :param num_batch_blocks: number of batch blocks memory_usage_limit_b is split into; with more (smaller) blocks
+            read_batch waits at most for one small block to fill
+        :param zero_copy: if row_size_b is a multiple of 512, rows are read directly into the output buffer
+        :param numa_policy: "none" or "local"; "local" pins worker threads and their buffers to the NUMA node of the drive
+            they read from and binds the output buffer to the node of the calling thread
+        :param sampling_mode: "random" draws chunks of rows with replacement; "epoch" reads every chunk once per epoch
+            (in a pseudo-random order that changes every epoch), see the epoch property
+        :param weights_path: optional file of (first_row, weight) records, e.g.
+            np.array(records, dtype=[("first_row", "<i8"), ("weight", "<f8")]).tofile(weights_path); rows from first_row
+            up to the next record's first_row are sampled with probability proportional to weight ("random" mode only)
+        :param projection: optional list of (offset_b, length_b) byte ranges of a row (multiples of the value size); batches
+            contain only these ranges, packed in the given order, and disk sectors holding none of them are not read
+        :param storage_format: "raw" or "compressed"; compressed files are containers of independently compressed chunks
+            created by lib/bin/nvme_pack, decompressed by worker threads
+        :param huge_pages: "none", "thp" (transparent huge pages), "2m" or "1g" (HugeTLB pages reserved in vm.nr_hugepages,
+            used by read buffers; the output buffer is allocated by torch and gets transparent huge pages); unavailable
+            pages fall back to smaller ones, see the page sizes in stats()
+        :param lock_memory: mlock() read buffers and the output buffer (needs a high enough RLIMIT_MEMLOCK)
+        :param checkpoint: bytes returned by checkpoint() of a sampler of the same files and parameters; the sampler continues
+            its sequence of batches (reading only the batch blocks from the checkpoint on)
+        :param value_format: "float32", "float16", "bfloat16" or "int8": values stored in the files (row_size_b and projection
+            are in bytes of the files); worker threads convert them, so batches are always float32 and 2-4 times more rows
+            are read for the same disk bandwidth
+        :param int8_scales: "int8" values only, optional scale of every column of a row (row_size_b values): a value is
+            int8 * scale + offset
+        :param int8_offsets: optional offset of every column of a row (given together with int8_scales)
+        :param submission_order: order in which reads prepared together are sent to the drive: "random" (as drawn),
+            "offset" (by offset, so adjacent reads can be merged) or "stripe" (by offset, interleaved over the members of
+            a RAID-0 array to balance their queues); batches are the same in every order
+        :param stripe_size_b: "stripe" order: chunk size of the RAID-0 array; 0 reads it (and num_stripe_devices) from
+            sysfs of the md array holding the file
+        :param num_stripe_devices: "stripe" order: number of members of the RAID-0 array (given together with stripe_size_b)
+        :param auto_tune: adjust io_queue_depth and the number of active worker threads while running, by the measured
+            samples per second and read latency; max_num_threads and io_queue_depth become upper bounds (see stats())
         """
         self.buffer = torch.FloatTensor()
 
+        checkpoint_struct = lib._ffi.NULL
+        if checkpoint is not None:
+            checkpoint_struct = lib._ffi.new("SamplerCheckpoint *")
+            assert len(checkpoint) == lib._ffi.sizeof("SamplerCheckpoint"), "not a sampler checkpoint"
+            lib._ffi.buffer(checkpoint_struct)[:] = checkpoint
+            if seed is None:
+                seed = checkpoint_struct.seed
+
         if seed is None:
             seed = random.randint(-1 << 31, (1 << 31) - 1)
 
-        num_rows, row_size_b, max_batch_elements, max_num_threads, memory_usage_limit_b = map(
-            int, [num_rows, row_size_b, max_batch_elements, max_num_threads, memory_usage_limit_b])
+        num_rows, row_size_b, max_batch_elements, max_num_threads, memory_usage_limit_b, io_queue_depth, num_batch_blocks = map(
+            int, [num_rows, row_size_b, max_batch_elements, max_num_threads, memory_usage_limit_b, io_queue_depth, num_batch_blocks])
+
+        assert value_format in VALUE_FORMATS, value_format
+        value_format_id, value_size_b = VALUE_FORMATS[value_format]
+        assert row_size_b % value_size_b == 0
+        assert io_engine in IO_ENGINES, io_engine
+        assert numa_policy in NUMA_POLICIES, numa_policy
+        assert sampling_mode in SAMPLING_MODES, sampling_mode
+        assert storage_format in STORAGE_FORMATS, storage_format
+        assert huge_pages in HUGE_PAGES, huge_pages
+        assert submission_order in SUBMISSION_ORDERS, submission_order
+
+        file_paths = [file_path] if isinstance(file_path, str) else list(file_path)
+
+        projection = [(int(offset_b), int(length_b)) for offset_b, length_b in projection or []]
+        for offset_b, length_b in projection:
+            assert offset_b % value_size_b == 0 and length_b % value_size_b == 0 and length_b > 0 and offset_b + length_b <= row_size_b, \
+                (offset_b, length_b)
+        stored_row_size_b = sum(length_b for _, length_b in projection) if projection else row_size_b
+        output_row_size_b = stored_row_size_b // value_size_b * 4
 
-        assert row_size_b % 4 == 0
+        int8_scales = [float(scale) for scale in int8_scales] if int8_scales is not None else []
+        int8_offsets = [float(offset) for offset in int8_offsets] if int8_offsets is not None else []
+        assert len(int8_scales) == len(int8_offsets), "int8_scales and int8_offsets must be given together"
+        assert not int8_scales or (value_format == "int8" and len(int8_scales) == row_size_b), len(int8_scales)
 
         ffi = cffi.FFI()
-        file_path = ffi.new("char[]", file_path.encode('utf8'))  # TODO test non-ascii paths
+        file_path_strings = [ffi.new("char[]", path.encode('utf8')) for path in file_paths]  # TODO test non-ascii paths
+        file_path_array = ffi.new("char *[]", file_path_strings)
+        projection_array = ffi.new("long[]", [value for byte_range in projection for value in byte_range])
+        int8_scales_array = ffi.new("float[]", int8_scales)
+        int8_offsets_array = ffi.new("float[]", int8_offsets)
 
-        self.handle = lib.init_sampler(
-            self.buffer, file_path, num_rows, row_size_b, max_batch_elements, max_num_threads, memory_usage_limit_b, seed)
-        self.row_size_b = row_size_b
-        self.row_size = row_size_b // 4
+        weights_path_string = ffi.new("char[]", weights_path.encode('utf8')) if weights_path is not None else ffi.NULL
+
+        # the struct does not own the arrays it points to: they are kept alive by the variables above
+        config = lib._ffi.new("SamplerConfig *", {
+            "max_batch_elements": max_batch_elements,
+            "max_num_threads": max_num_threads,
+            "memory_usage_limit_b": memory_usage_limit_b,
+            "seed": seed,
+            "io_engine": IO_ENGINES[io_engine],
+            "io_queue_depth": io_queue_depth,
+            "num_batch_blocks": num_batch_blocks,
+            "zero_copy": int(bool(zero_copy)),
+            "numa_policy": NUMA_POLICIES[numa_policy],
+            "sampling_mode": SAMPLING_MODES[sampling_mode],
+            "weights_path": weights_path_string,
+            "projection": projection_array,
+            "projection_size": 2 * len(projection),
+            "storage_format": STORAGE_FORMATS[storage_format],
+            "huge_pages": HUGE_PAGES[huge_pages],
+            "lock_memory": int(bool(lock_memory)),
+            "value_format": value_format_id,
+            "int8_scales": int8_scales_array,
+            "int8_offsets": int8_offsets_array,
+            "int8_columns": len(int8_scales),
+            "submission_order": SUBMISSION_ORDERS[submission_order],
+            "stripe_size_b": int(stripe_size_b),
+            "num_stripe_devices": int(num_stripe_devices),
+            "auto_tune": int(bool(auto_tune)),
+        })
+        self.handle = lib.init_sampler(self.buffer, file_path_array, len(file_paths), num_rows, row_size_b, config,
+                                       checkpoint_struct)
+        self.row_size_b = output_row_size_b
+        self.row_size = output_row_size_b // 4
         self.num_rows = num_rows
+        self.consumer = 0
+        self._ready_callback = None
 
-    def read_batch(self, batch_size):
+    def create_consumer(self):
         """
-        Reads next batch.
+        Returns a new consumer reading batches concurrently with the sampler and its other consumers (e.g. one per
+        data-feeding thread), all fed by the same worker threads and output buffer. Every consumer keeps the batch block it
+        reads from until it moves to the next one, so num_batch_blocks should exceed the number of consumers by 2.
+        """
+        return SamplerConsumer(self, lib.create_consumer(self.handle))
 
-        :param batch_size must be smaller than max_batch_elements
+    def set_ready_callback(self, callback):
         """
-        offset = lib.read_batch(self.handle, batch_size)
-        if offset < 0:
-            raise Exception("Failed to read data")
+        Sets callback() called from a worker thread whenever a batch block is filled (None removes it). It must be short
+        and must not use the sampler, e.g. loop.call_soon_threadsafe(event.set).
+        """
+        if callback is None:
+            lib.set_ready_callback(self.handle, lib._ffi.NULL, lib._ffi.NULL)
+            self._ready_callback = None
+        else:
+            # the cffi callback must outlive its last call, so it is replaced only after set_ready_callback returns
+            ready_callback = lib._ffi.callback("void(void *)", lambda _: callback())
+            lib.set_ready_callback(self.handle, ready_callback, lib._ffi.NULL)
+            self._ready_callback = ready_callback
 
-        return self.buffer[offset: offset + batch_size * self.row_size].view(batch_size, self.row_size_b // 4)
+    def checkpoint(self):
+        """
+        Returns the position of the sampler after the batches read so far as bytes, e.g. to be saved with a model checkpoint
+        and passed as the checkpoint argument of a new sampler after a restart. With several consumers it is the position in
+        the batch block they share.
+        """
+        checkpoint = lib._ffi.new("SamplerCheckpoint *")
+        lib.get_checkpoint(self.handle, checkpoint)
+        return bytes(lib._ffi.buffer(checkpoint))
+
+    @property
+    def epoch(self):
+        """
+        Epoch of recently read batches in "epoch" sampling mode (always 0 otherwise). It grows roughly every num_rows samples;
+        batches read around an epoch boundary may contain samples of both epochs.
+        """
+        return lib.get_epoch(self.handle)
+
+    def stats(self):
+        """
+        Returns sampler statistics: totals over all worker threads, consumer-side counters and a list of per-worker stats.
+
+        Worker time is split into io_wait_ns (I/O bound), scatter_ns (memcpy bound), decompress_ns (compressed files only,
+        CPU bound) and idle_ns (consumer bound).
+        consumer_wait_ns is the time read_batch() spent waiting for a batch block. batch_blocks_page_size_b and
+        read_buffers_page_size_b tell which pages the huge_pages option actually got (4096 after a fall back).
+        num_active_workers and io_queue_depth are the concurrency currently chosen by auto_tune.
+        """
+        stats = lib._ffi.new("SamplerStats *")
+        lib.get_stats(self.handle, stats)
+
+        result = {field: getattr(stats.workers, field) for field in WORKER_STATS_FIELDS}
+        result.update({field: getattr(stats, field) for field in CONSUMER_STATS_FIELDS})
+        result.update({field: getattr(stats, field) for field in MEMORY_STATS_FIELDS})
+        result.update({field: getattr(stats, field) for field in CONCURRENCY_STATS_FIELDS})
+        result["elapsed_ns"] = stats.elapsed_ns
+        result["workers"] = []
+
+        worker_stats = lib._ffi.new("WorkerStats *")
+        for worker_idx in range(stats.num_workers):
+            lib.get_worker_stats(self.handle, worker_idx, worker_stats)
+            result["workers"].append({field: getattr(worker_stats, field) for field in WORKER_STATS_FIELDS})
+
+        return result
 
     def __del__(self):
         lib.destroy_sampler(self.handle)
+
+
+class SamplerConsumer(BatchReader):
+    def __init__(self, sampler, consumer):
+        self.sampler = sampler  # keeps the sampler alive
+        self.handle = sampler.handle
+        self.buffer = sampler.buffer
+        self.row_size_b = sampler.row_size_b
+        self.row_size = sampler.row_size
+        self.consumer = consumer
+
+
+class NvmeSamplerClient(object):
+    def __init__(self, socket_path, batch_size, prefetch_batches=4):
+        """
+        Reads batches from a sampler server (lib/bin/nvme_sampler_server), which serves many processes from one set of
+        worker threads and one output buffer in shared memory; processes reading the same dataset should use one server.
+
+        :param batch_size: rows in every batch (at most the server's max_batch_elements)
+        :param prefetch_batches: batches the server keeps ready for the client (fewer than 256)
+        """
+        ffi = cffi.FFI()
+        self.handle = lib.connect_sampler(ffi.new("char[]", socket_path.encode('utf8')), int(batch_size), int(prefetch_batches))
+        self.batch_size = int(batch_size)
+        self.row_size_b = lib.get_client_row_size(self.handle)
+        self.row_size = self.row_size_b // 4
+
+        # batch memory is mapped read-only: other processes read the same batches
+        self.data = mmap.mmap(lib.get_client_data_fd(self.handle), lib.get_client_data_size(self.handle), prot=mmap.PROT_READ)
+        with warnings.catch_warnings():
+            warnings.filterwarnings("ignore", message="The given buffer is not writable")
+            self.buffer = torch.frombuffer(self.data, dtype=torch.float32)
+
+    def read_batch(self):
+        """
+        Reads next batch; it stays valid until the next call.
+        """
+        offset = lib.client_read_batch(self.handle)
+        if offset < 0:
+            raise Exception("Sampler server is gone")
+
+        return self.buffer[offset: offset + self.batch_size * self.row_size].view(self.batch_size, self.row_size)
+
+    def __del__(self):
+        lib.disconnect_sampler(self.handle)
@@ -1,6 +1,7 @@
 #include <TH/TH.h>
 #include <assert.h>
 #include <string>
+#include <vector>
 
 #include "nvme_api.h"
 
@@ -32,27 +33,23 @@ void deleter(void *user_data_opaque, nvme_sampler::api::byte *address) {
 }
 
 handle init_sampler(THFloatTensor *buffer,
-                    const char *file_path,
+                    const char **file_paths,
+                    int64_t num_files,
                     int64_t num_rows,
                     int64_t row_size,
-                    int64_t max_batch_elements,
-                    int64_t max_num_threads,
-                    int64_t memory_usage_limit_b,
-                    int32_t seed
-
+                    const nvme_sampler::api::SamplerConfig *config,
+                    const nvme_sampler::api::SamplerCheckpoint *checkpoint
 ) {
     UserData *user_data = new UserData(buffer);
     handle sampler = nvme_sampler::api::init_sampler(
             user_data,
             &allocator,
             &deleter,
-            std::string(file_path),
+            std::vector<std::string>(file_paths, file_paths + num_files),
             num_rows,
             row_size,
-            max_batch_elements,
-            max_num_threads,
-            memory_usage_limit_b,
-            seed
+            *config,
+            checkpoint
     );
     return sampler;
 }
@@ -64,10 +61,80 @@ void destroy_sampler(handle sampler) {
 
 }
 
-long read_batch(handle sampler, long batch_size) {
-    float *addr = reinterpret_cast<float *>(nvme_sampler::api::read_batch(reinterpret_cast<nvme_sampler::api::SamplerHandle *>(sampler), batch_size));
+long create_consumer(handle sampler) {
+    return nvme_sampler::api::create_consumer(reinterpret_cast<nvme_sampler::api::handle>(sampler));
+}
+
+long read_batch(handle sampler, long consumer, long batch_size) {
+    float *addr = reinterpret_cast<float *>(nvme_sampler::api::read_batch(reinterpret_cast<nvme_sampler::api::SamplerHandle *>(sampler), consumer, batch_size));
     return addr - get_user_data(sampler)->buffer->storage->data;
 }
 
+long lease_batch(handle sampler, long consumer, long batch_size) {
+    float *addr = reinterpret_cast<float *>(nvme_sampler::api::lease_batch(reinterpret_cast<nvme_sampler::api::handle>(sampler), consumer, batch_size));
+    return addr - get_user_data(sampler)->buffer->storage->data;
 }
 
+void release_batch(handle sampler, long offset) {
+    float *addr = get_user_data(sampler)->buffer->storage->data + offset;
+    nvme_sampler::api::release_batch(reinterpret_cast<nvme_sampler::api::handle>(sampler), reinterpret_cast<nvme_sampler::api::byte *>(addr));
+}
+
+// -1 if no batch is ready
+long try_read_batch(handle sampler, long consumer, long batch_size) {
+    float *addr = reinterpret_cast<float *>(nvme_sampler::api::try_read_batch(reinterpret_cast<nvme_sampler::api::handle>(sampler), consumer, batch_size));
+    return addr ? addr - get_user_data(sampler)->buffer->storage->data : -1;
+}
+
+int get_ready_fd(handle sampler) {
+    return nvme_sampler::api::get_ready_fd(reinterpret_cast<nvme_sampler::api::handle>(sampler));
+}
+
+void set_ready_callback(handle sampler, void (*callback)(void *), void *callback_data) {
+    nvme_sampler::api::set_ready_callback(reinterpret_cast<nvme_sampler::api::handle>(sampler), callback, callback_data);
+}
+
+long get_epoch(handle sampler) {
+    return nvme_sampler::api::get_epoch(reinterpret_cast<nvme_sampler::api::handle>(sampler));
+}
+
+void get_checkpoint(handle sampler, nvme_sampler::api::SamplerCheckpoint *checkpoint) {
+    nvme_sampler::api::get_checkpoint(reinterpret_cast<nvme_sampler::api::handle>(sampler), checkpoint);
+}
+
+void get_stats(handle sampler, nvme_sampler::api::SamplerStats *stats) {
+    nvme_sampler::api::get_stats(reinterpret_cast<nvme_sampler::api::handle>(sampler), stats);
+}
+
+void get_worker_stats(handle sampler, long worker_idx, nvme_sampler::api::WorkerStats *stats) {
+    nvme_sampler::api::get_worker_stats(reinterpret_cast<nvme_sampler::api::handle>(sampler), worker_idx, stats);
+}
+
+handle connect_sampler(const char *socket_path, long batch_size, long prefetch_batches) {
+    return nvme_sampler::api::connect_sampler(socket_path, batch_size, prefetch_batches);
+}
+
+void disconnect_sampler(handle client) {
+    nvme_sampler::api::disconnect_sampler(reinterpret_cast<nvme_sampler::api::client_handle>(client));
+}
+
+// offset (in floats) of the batch in the client's data memory, -1 if the server is gone
+long client_read_batch(handle client) {
+    auto client_handle = reinterpret_cast<nvme_sampler::api::client_handle>(client);
+    nvme_sampler::api::byte *addr = nvme_sampler::api::client_read_batch(client_handle);
+    return addr ? (addr - nvme_sampler::api::get_client_data(client_handle)) / static_cast<long>(sizeof(float)) : -1;
+}
+
+long get_client_row_size(handle client) {
+    return nvme_sampler::api::get_client_row_size(reinterpret_cast<nvme_sampler::api::client_handle>(client));
+}
+
+int get_client_data_fd(handle client) {
+    return nvme_sampler::api::get_client_data_fd(reinterpret_cast<nvme_sampler::api::client_handle>(client));
+}
+
+long get_client_data_size(handle client) {
+    return nvme_sampler::api::get_client_data_size(reinterpret_cast<nvme_sampler::api::client_handle>(client));
+}
+
+}
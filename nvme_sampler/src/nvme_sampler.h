@@ -1,14 +1,124 @@
 typedef void *handle;
 
+typedef void (*ReadyCallback)(void *);
+
+// must match nvme_sampler::api::WorkerStats
+typedef struct {
+    long reads_submitted;
+    long reads_completed;
+    long bytes_read;
+    long bytes_wasted;
+    long samples_read;
+    long io_wait_ns;
+    long scatter_ns;
+    long decompress_ns;
+    long idle_ns;
+    long io_latency_p50_ns;
+    long io_latency_p90_ns;
+    long io_latency_p99_ns;
+    long io_latency_p999_ns;
+} WorkerStats;
+
+// must match nvme_sampler::api::SamplerStats
+typedef struct {
+    long elapsed_ns;
+    long num_workers;
+    long num_consumers;
+    WorkerStats workers;
+    long blocks_consumed;
+    long batches_consumed;
+    long samples_consumed;
+    long consumer_wait_ns;
+    long batch_blocks_page_size_b;
+    long read_buffers_page_size_b;
+    long locked_memory_b;
+    long num_active_workers;
+    long io_queue_depth;
+} SamplerStats;
+
+// must match nvme_sampler::api::SamplerCheckpoint
+typedef struct {
+    long version;
+    long seed;
+    long num_rows;
+    long num_shards;
+    long max_batch_elements;
+    long num_batches_in_block;
+    long sampling_mode;
+    long sequence_number;
+    long read_idx;
+    long epoch;
+    long epoch_positions[64];
+} SamplerCheckpoint;
+
+// must match nvme_sampler::api::SamplerConfig
+typedef struct {
+    long max_batch_elements;
+    long max_num_threads;
+    long memory_usage_limit_b;
+    int seed;
+    int io_engine;
+    int io_queue_depth;
+    int num_batch_blocks;
+    int zero_copy;
+    int numa_policy;
+    int sampling_mode;
+    const char *weights_path;
+    const long *projection;
+    long projection_size;
+    int storage_format;
+    int huge_pages;
+    int lock_memory;
+    int value_format;
+    const float *int8_scales;
+    const float *int8_offsets;
+    long int8_columns;
+    int submission_order;
+    long stripe_size_b;
+    int num_stripe_devices;
+    int auto_tune;
+} SamplerConfig;
+
 handle init_sampler(THFloatTensor *buffer,
-                    const char *file_path,
+                    const char **file_paths,
+                    long num_files,
                     long num_rows,
                     long row_size,
-                    long max_batch_elements,
-                    long max_num_threads,
-                    long memory_usage_limit_b,
-                    int seed);
+                    const SamplerConfig *config,
+                    const SamplerCheckpoint *checkpoint);
 
 void destroy_sampler(handle sampler);
 
-long read_batch(handle sampler, long batch_size);
+long create_consumer(handle sampler);
+
+long read_batch(handle sampler, long consumer, long batch_size);
+
+long lease_batch(handle sampler, long consumer, long batch_size);
+
+void release_batch(handle sampler, long offset);
+
+long try_read_batch(handle sampler, long consumer, long batch_size);
+
+int get_ready_fd(handle sampler);
+
+void set_ready_callback(handle sampler, ReadyCallback callback, void *callback_data);
+
+long get_epoch(handle sampler);
+
+void get_checkpoint(handle sampler, SamplerCheckpoint *checkpoint);
+
+void get_stats(handle sampler, SamplerStats *stats);
+
+void get_worker_stats(handle sampler, long worker_idx, WorkerStats *stats);
+
+handle connect_sampler(const char *socket_path, long batch_size, long prefetch_batches);
+
+void disconnect_sampler(handle client);
+
+long client_read_batch(handle client);
+
+long get_client_row_size(handle client);
+
+int get_client_data_fd(handle client);
+
+long get_client_data_size(handle client);
@@ -31,6 +31,10 @@ def test_sampler():
             samples_per_sec = num_samples_read / duration
             bw_gib = num_samples_read * row_size_b / duration / (2 ** 30)
             print("Throughput: %f samples/s; %f GiB/s" % (samples_per_sec, bw_gib))
+            stats = sampler.stats()
+            print("Workers: io_wait=%.1fs scatter=%.1fs idle=%.1fs; io latency p50=%dus p99=%dus; consumer wait=%.1fs" % (
+                stats["io_wait_ns"] / 1e9, stats["scatter_ns"] / 1e9, stats["idle_ns"] / 1e9,
+                stats["io_latency_p50_ns"] // 1000, stats["io_latency_p99_ns"] // 1000, stats["consumer_wait_ns"] / 1e9))
         t = sampler.read_batch(batch_size)
         # t.sum()
 
@@ -1,17 +1,26 @@
+import asyncio
 import math
 import os.path
+import select
+import subprocess
+import threading
+import time
 
 import numpy as np
 import scipy.stats
 import torch
 
-from nvme_sampler import NvmeSampler
+from nvme_sampler import NvmeSampler, NvmeSamplerClient
 
 NVME_WORKDIR = os.getenv("NVME_WORKDIR")
 
 assert NVME_WORKDIR is not None, "'NVME_WORKDIR' environment is not set"
 
 file_path = os.path.join(NVME_WORKDIR, "nvme_test.bin")
+compressed_file_path = os.path.join(NVME_WORKDIR, "nvme_test.nvmz")
+pack_path = os.path.join(os.path.dirname(__file__), "..", "lib", "bin", "nvme_pack")
+server_path = os.path.join(os.path.dirname(__file__), "..", "lib", "bin", "nvme_sampler_server")
+socket_path = os.path.join(NVME_WORKDIR, "nvme_test.sock")
 
 
 def create_file(num_rows, row_size_b):
@@ -32,6 +41,18 @@ def create_file(num_rows, row_size_b):
     return tensor
 
 
+# sampler of the test file with a fixed seed, so it reads the same batches every time whatever the number of worker
+# threads (keyword arguments override its parameters)
+def create_seeded_sampler(num_rows, row_size_b, **kwargs):
+    params = dict(max_batch_elements=128, max_num_threads=4, memory_usage_limit_b=2 * 2 ** 24, seed=7, num_batch_blocks=4)
+    params.update(kwargs)
+    return NvmeSampler(file_path, num_rows=num_rows, row_size_b=row_size_b, **params)
+
+
+def read_batches(sampler, num_batches):
+    return torch.cat([sampler.read_batch(100).clone() for _ in range(num_batches)])
+
+
 def test_sampler(num_rows, row_size_b, num_samples):
     print("Checking row_size_b=%d" % row_size_b)
 
@@ -92,7 +113,549 @@ def test_sampler(num_rows, row_size_b, num_samples):
     assert (np.abs(expected_percentiles - result_percentiles) >= expected_percentiles * 0.1).sum() == 0
 
 
+def test_io_engine_sampler(num_rows, row_size_b, num_batches):
+    print("Checking io engines, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    # io_uring falls back to libaio where it is not supported, so the batches are the same either way
+    batches = read_batches(create_seeded_sampler(num_rows, row_size_b, io_engine="libaio"), num_batches)
+    assert ((batches - tensor[batches[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+    for io_engine in ("io_uring", "io_uring_sqpoll"):
+        assert batches.equal(read_batches(create_seeded_sampler(num_rows, row_size_b, io_engine=io_engine), num_batches))
+
+
+def test_zero_copy_sampler(num_rows, row_size_b, num_batches):
+    print("Checking zero-copy reads, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    buffered_sampler = create_seeded_sampler(num_rows, row_size_b, zero_copy=False)
+    zero_copy_sampler = create_seeded_sampler(num_rows, row_size_b, zero_copy=True)
+    batches = read_batches(buffered_sampler, num_batches)
+    assert ((batches - tensor[batches[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+    assert batches.equal(read_batches(zero_copy_sampler, num_batches))
+
+    # zero-copy workers have no read buffers
+    assert buffered_sampler.stats()["read_buffers_page_size_b"] > 0
+    assert zero_copy_sampler.stats()["read_buffers_page_size_b"] == 0
+
+
+def test_sharded_sampler(shard_rows, row_size_b, num_batches):
+    print("Checking shards of %s rows, row_size_b=%d" % (shard_rows, row_size_b))
+
+    num_rows = sum(shard_rows)
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+    shard_paths = [os.path.join(NVME_WORKDIR, "nvme_test.shard%d.bin" % shard_idx) for shard_idx in range(len(shard_rows))]
+    shard_starts = np.cumsum([0] + shard_rows)
+    for shard_idx, shard_path in enumerate(shard_paths):
+        tensor[shard_starts[shard_idx]:shard_starts[shard_idx + 1]].numpy().tofile(shard_path)
+
+    sampler = NvmeSampler(shard_paths,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24)
+
+    counts = np.zeros(num_rows)
+    for i in range(num_batches):
+        t = sampler.read_batch(100)
+        idx = t[:, 0].long()
+        assert ((t - tensor[idx]).abs().sum(dim=1) < 0.01).all()
+        counts[idx.numpy()] += 1
+
+    # rows of a shard are drawn in proportion to its size, uniformly within it; the last two chunks (at most 64 KiB each)
+    # of every shard are never read
+    tail_rows = 2 * 2 ** 16 // row_size_b + 1
+    for shard_idx in range(len(shard_rows)):
+        shard_counts = counts[shard_starts[shard_idx]:shard_starts[shard_idx + 1]]
+        frequency = shard_counts.sum() / counts.sum()
+        expected_frequency = shard_rows[shard_idx] / num_rows
+        print(shard_idx, frequency, expected_frequency, (shard_counts == 0).sum())
+        assert abs(frequency - expected_frequency) < expected_frequency * 0.05, (frequency, expected_frequency)
+        assert (shard_counts[:-tail_rows] == 0).sum() == 0, (shard_counts[:-tail_rows] == 0).sum()
+
+    for shard_path in shard_paths:
+        os.remove(shard_path)
+
+
+def test_epoch_sampler(num_rows, row_size_b, num_epochs):
+    print("Checking epoch mode, row_size_b=%d" % row_size_b)
+
+    create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          sampling_mode="epoch")
+
+    counts = np.zeros(num_rows)
+    for i in range(num_epochs * num_rows // 100):
+        t = sampler.read_batch(100)
+        counts[t[:, 0].long().numpy()] += 1
+
+    # without replacement every row is seen once per epoch (+-1 for batches read around epoch boundaries)
+    print(sampler.epoch, np.max(counts), (counts == 0).sum())
+    assert num_epochs - 2 <= sampler.epoch <= num_epochs
+    assert np.max(counts) <= num_epochs + 1, np.max(counts)
+    assert (counts == 0).sum() <= (2 * 3 * 4096) / (row_size_b // 4), (counts == 0).sum()
+
+
+def test_weighted_sampler(num_rows, row_size_b, num_batches):
+    print("Checking weighted sampling, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+    weights_path = os.path.join(NVME_WORKDIR, "nvme_test.weights")
+    cache_path = weights_path + ".alias0"
+    if os.path.exists(cache_path):
+        os.remove(cache_path)
+
+    def write_weights(records):
+        np.array(records, dtype=[("first_row", "<i8"), ("weight", "<f8")]).tofile(weights_path)
+
+    def read_counts():
+        sampler = NvmeSampler(file_path,
+                              num_rows=num_rows,
+                              row_size_b=row_size_b,
+                              max_batch_elements=128,
+                              max_num_threads=8,
+                              memory_usage_limit_b=2 * 2 ** 24,
+                              weights_path=weights_path)
+        counts = np.zeros(num_rows)
+        for i in range(num_batches):
+            t = sampler.read_batch(100)
+            idx = t[:, 0].long()
+            assert ((t - tensor[idx]).abs().sum(dim=1) < 0.01).all()
+            counts[idx.numpy()] += 1
+        return counts
+
+    # chunks are drawn by the total weight of their rows: rows up to a chunk (at most 64 KiB) away from a range boundary
+    # share the weight of the other side
+    margin = 2 ** 16 // row_size_b + 1
+    quarter = num_rows // 4
+    half = num_rows // 2
+
+    write_weights([(0, 1.0), (half, 3.0)])
+    counts = read_counts()
+    frequency = counts[:half].sum() / counts.sum()
+    print(frequency)
+    assert abs(frequency - 0.25) < 0.01, frequency
+    cache_inode = os.stat(cache_path).st_ino
+
+    # the same weights file: the cached table is reused
+    read_counts()
+    assert os.stat(cache_path).st_ino == cache_inode
+
+    # a weights file of another size: the table is rebuilt
+    write_weights([(0, 0.0), (quarter, 1.0), (half, 1.0)])
+    counts = read_counts()
+    assert os.stat(cache_path).st_ino != cache_inode
+    cache_inode = os.stat(cache_path).st_ino
+    frequency = counts[:half].sum() / counts.sum()
+    print(frequency)
+    assert counts[:quarter - margin].sum() == 0
+    assert abs(frequency - 1 / 3) < 0.01, frequency
+
+    # a weights file of the same size with a later mtime: the table is rebuilt
+    mtime_ns = os.stat(weights_path).st_mtime_ns
+    write_weights([(0, 1.0), (quarter, 1.0), (half, 0.0)])
+    os.utime(weights_path, ns=(mtime_ns + 10 ** 9, mtime_ns + 10 ** 9))
+    counts = read_counts()
+    assert os.stat(cache_path).st_ino != cache_inode
+    assert counts[half + margin:].sum() == 0
+
+    os.remove(weights_path)
+    os.remove(cache_path)
+
+
+def test_projection_sampler(num_rows, row_size_b, projection, num_samples):
+    print("Checking projection=%s, row_size_b=%d" % (projection, row_size_b))
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          projection=projection)
+
+    columns = torch.cat([torch.arange(offset_b // 4, (offset_b + length_b) // 4) for offset_b, length_b in projection]).long()
+    assert sampler.row_size == len(columns)
+
+    for i in range(num_samples // 100):
+        t = sampler.read_batch(100)
+        idx = t[:, 0].floor().long()  # every value of row idx lies in [idx, idx + 0.5]
+        assert ((t - tensor[idx][:, columns]).abs().sum(dim=1) < 0.01).all()
+
+
+def test_compressed_sampler(num_rows, row_size_b, codec, num_samples):
+    print("Checking compressed file, codec=%s, row_size_b=%d" % (codec, row_size_b))
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+    subprocess.check_call([pack_path, file_path, compressed_file_path, str(row_size_b), codec])
+
+    sampler = NvmeSampler(compressed_file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          storage_format="compressed")
+
+    counts = np.zeros(num_rows)
+    for i in range(num_samples // 100):
+        t = sampler.read_batch(100)
+        idx = t[:, 0].long()
+        assert ((t - tensor[idx]).abs().sum(dim=1) < 0.01).all()
+        counts[idx.numpy()] += 1
+
+    stats = sampler.stats()
+    print(stats["bytes_read"], stats["samples_read"], stats["decompress_ns"], (counts == 0).sum())
+    assert stats["bytes_read"] < stats["samples_read"] * row_size_b  # rows of the test file compress well
+    assert (counts == 0).sum() == 0, (counts == 0).sum()  # chunks are read whole, including the last one
+
+
+def test_huge_pages_sampler(num_rows, row_size_b, huge_pages):
+    print("Checking huge_pages=%s, row_size_b=%d" % (huge_pages, row_size_b))
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          huge_pages=huge_pages,
+                          lock_memory=True)
+
+    for i in range(1000):
+        t = sampler.read_batch(100)
+        assert ((t - tensor[t[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+
+    # pages fall back to smaller ones if huge pages are not configured on the test machine
+    stats = sampler.stats()
+    print(stats["batch_blocks_page_size_b"], stats["read_buffers_page_size_b"], stats["locked_memory_b"])
+    assert stats["batch_blocks_page_size_b"] in (4096, 2 ** 21)
+    assert stats["read_buffers_page_size_b"] in (4096, 2 ** 21, 2 ** 30)
+
+
+def test_non_blocking_sampler(num_rows, row_size_b, num_batches):
+    print("Checking non-blocking reads, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          num_batch_blocks=4)
+
+    num_callbacks = [0]
+    sampler.set_ready_callback(lambda: num_callbacks.__setitem__(0, num_callbacks[0] + 1))
+
+    num_waits = 0
+    for i in range(num_batches):
+        t = sampler.try_read_batch(100)
+        while t is None:
+            num_waits += 1
+            readable, _, _ = select.select([sampler.ready_fd], [], [], 10.0)
+            assert readable, "no batch block was filled in 10 seconds"
+            t = sampler.try_read_batch(100)
+        assert ((t - tensor[t[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+
+    async def read_batches():
+        for i in range(num_batches):
+            t = await sampler.read_batch_async(100)
+            assert ((t - tensor[t[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+
+    asyncio.get_event_loop().run_until_complete(read_batches())
+
+    sampler.set_ready_callback(None)
+    print(num_waits, num_callbacks[0], sampler.stats()["blocks_consumed"])
+    assert num_callbacks[0] >= sampler.stats()["blocks_consumed"] - 4  # blocks filled before the callback was set
+
+
+def test_leased_sampler(num_rows, row_size_b, num_batches, num_leased):
+    print("Checking leased batches, num_leased=%d" % num_leased)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          num_batch_blocks=4)
+
+    # leased batches must not be overwritten by workers while they are held
+    leased = []
+    for i in range(num_batches):
+        t = sampler.lease_batch(100)
+        assert ((t - tensor[t[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+        leased.append((t, t.clone()))
+        if len(leased) > num_leased:
+            t, copy = leased.pop(0)
+            assert t.equal(copy)
+            sampler.release_batch(t)
+
+    for t, copy in leased:
+        assert t.equal(copy)
+        sampler.release_batch(t)
+
+
+def test_multi_consumer_sampler(num_rows, row_size_b, num_consumers, num_batches):
+    print("Checking %d consumer threads" % num_consumers)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          num_batch_blocks=num_consumers + 2)
+
+    consumers = [sampler] + [sampler.create_consumer() for _ in range(num_consumers - 1)]
+    counts = [np.zeros(num_rows) for _ in consumers]
+    errors = []
+
+    def consume(consumer, consumer_counts):
+        try:
+            for i in range(num_batches):
+                t = consumer.read_batch(100)
+                assert ((t - tensor[t[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+                consumer_counts[t[:, 0].long().numpy()] += 1
+        except Exception as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=consume, args=args) for args in zip(consumers, counts)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    assert not errors, errors
+    stats = sampler.stats()
+    print(stats["num_consumers"], stats["blocks_consumed"], stats["batches_consumed"])
+    assert stats["num_consumers"] == num_consumers
+    assert stats["batches_consumed"] == num_consumers * num_batches
+    assert sum(c.sum() for c in counts) == num_consumers * num_batches * 100
+
+
+def test_sampler_server(num_rows, row_size_b, num_clients, num_batches):
+    print("Checking sampler server with %d clients" % num_clients)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    if os.path.exists(socket_path):
+        os.unlink(socket_path)
+    server = subprocess.Popen([server_path, socket_path, file_path, str(row_size_b), str(num_rows), "128", "8", str(2 * 2 ** 24), "16"])
+    try:
+        for _ in range(100):
+            if os.path.exists(socket_path):
+                break
+            time.sleep(0.1)
+
+        clients = [NvmeSamplerClient(socket_path, batch_size=100 + client_idx) for client_idx in range(num_clients)]
+        for i in range(num_batches):
+            for client in clients:
+                t = client.read_batch()
+                assert t.size(0) == client.batch_size
+                assert ((t - tensor[t[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+        del clients
+    finally:
+        server.terminate()
+        assert server.wait() == 0
+
+
+def test_deterministic_sampler(num_rows, row_size_b, num_batches):
+    print("Checking determinism of seeded sampling, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    batches = read_batches(create_seeded_sampler(num_rows, row_size_b, max_num_threads=1), num_batches)
+    assert ((batches - tensor[batches[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+    for max_num_threads in (2, 8):
+        assert batches.equal(read_batches(create_seeded_sampler(num_rows, row_size_b, max_num_threads=max_num_threads), num_batches))
+    assert not batches.equal(read_batches(create_seeded_sampler(num_rows, row_size_b, max_num_threads=8, seed=8), num_batches))
+
+
+def test_chunk_position_sampler(num_rows, row_size_b, chunk_rows, num_samples):
+    print("Checking sampling by position in chunk, chunk_rows=%d, row_size_b=%d" % (chunk_rows, row_size_b))
+
+    create_file(num_rows=num_rows, row_size_b=row_size_b)
+    subprocess.check_call([pack_path, file_path, compressed_file_path, str(row_size_b), "lz4", str(chunk_rows * row_size_b)])
+
+    # columns of a batch block (128 rows here) are not a multiple of chunk_rows, so the last read of every column takes
+    # only some rows of its chunk
+    sampler = NvmeSampler(compressed_file_path,
+                          num_rows=num_rows,
+                          row_size_b=row_size_b,
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          storage_format="compressed")
+
+    counts = np.zeros(chunk_rows)
+    for i in range(num_samples // 100):
+        t = sampler.read_batch(100)
+        positions = t[:, 0].long().numpy() % chunk_rows
+        counts += np.bincount(positions, minlength=chunk_rows)
+
+    frequencies = counts / counts.mean()
+    print(frequencies.min(), frequencies.max())
+    assert frequencies.min() > 0.95 and frequencies.max() < 1.05, frequencies
+
+
+def test_checkpoint_sampler(num_rows, row_size_b, num_batches, sampling_mode):
+    print("Checking checkpoint and restore, sampling_mode=%s" % sampling_mode)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = create_seeded_sampler(num_rows, row_size_b, max_num_threads=8, seed=11, sampling_mode=sampling_mode)
+    read_batches(sampler, num_batches)
+    checkpoint = sampler.checkpoint()
+    expected = read_batches(sampler, num_batches)
+    del sampler
+
+    restored = create_seeded_sampler(num_rows, row_size_b, max_num_threads=8, seed=None, sampling_mode=sampling_mode,
+                                     checkpoint=checkpoint)
+    batches = read_batches(restored, num_batches)
+    assert ((batches - tensor[batches[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+    if sampling_mode == "random":
+        assert batches.equal(expected)
+        assert restored.checkpoint() != checkpoint
+
+
+def test_value_format_sampler(num_rows, num_columns, value_format, num_batches):
+    print("Checking value_format=%s" % value_format)
+
+    random_state = np.random.RandomState(0)
+    int8_scales, int8_offsets = None, None
+    if value_format == "float16":
+        values = random_state.randn(num_rows, num_columns).astype(np.float16)
+        expected = values.astype(np.float32)
+    elif value_format == "bfloat16":
+        values = (random_state.randn(num_rows, num_columns).astype(np.float32).view(np.uint32) >> 16).astype(np.uint16)
+        expected = (values.astype(np.uint32) << 16).view(np.float32)
+    else:
+        values = random_state.randint(-128, 128, size=(num_rows, num_columns)).astype(np.int8)
+        # powers of two and integers: value * scale + offset is exact, so it does not depend on rounding
+        int8_scales = 2.0 ** random_state.randint(-4, 4, size=num_columns)
+        int8_offsets = random_state.randint(-100, 100, size=num_columns).astype(np.float64)
+        expected = (values * int8_scales + int8_offsets).astype(np.float32)
+    values.tofile(file_path)
+    rows = {row.tobytes(): row_idx for row_idx, row in enumerate(expected)}
+
+    sampler = NvmeSampler(file_path,
+                          num_rows=num_rows,
+                          row_size_b=values.strides[0],
+                          max_batch_elements=128,
+                          max_num_threads=8,
+                          memory_usage_limit_b=2 * 2 ** 24,
+                          value_format=value_format,
+                          int8_scales=int8_scales,
+                          int8_offsets=int8_offsets)
+    assert sampler.row_size == num_columns
+
+    for i in range(num_batches):
+        batch = sampler.read_batch(100).numpy()
+        for row in batch:
+            assert row.tobytes() in rows, row
+
+
+def test_submission_order_sampler(num_rows, row_size_b, num_batches):
+    print("Checking submission orders, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    batches = read_batches(create_seeded_sampler(num_rows, row_size_b, submission_order="random"), num_batches)
+    assert ((batches - tensor[batches[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+    for submission_order in ("offset", "stripe"):
+        # the test file is not on a RAID-0 array: without the geometry stripe order only sorts reads by offset
+        assert batches.equal(read_batches(create_seeded_sampler(num_rows, row_size_b, submission_order=submission_order), num_batches))
+    assert batches.equal(read_batches(create_seeded_sampler(num_rows, row_size_b, submission_order="stripe", stripe_size_b=2 ** 16,
+                                                            num_stripe_devices=4), num_batches))
+
+
+def test_auto_tune_sampler(num_rows, row_size_b, num_batches):
+    print("Checking auto-tuned concurrency, row_size_b=%d" % row_size_b)
+
+    tensor = create_file(num_rows=num_rows, row_size_b=row_size_b)
+
+    sampler = create_seeded_sampler(num_rows, row_size_b, max_num_threads=8, io_queue_depth=64, auto_tune=True)
+    reference = create_seeded_sampler(num_rows, row_size_b, max_num_threads=8, io_queue_depth=64, auto_tune=False)
+    for _ in range(num_batches):
+        batch = sampler.read_batch(100)
+        assert ((batch - tensor[batch[:, 0].long()]).abs().sum(dim=1) < 0.01).all()
+        assert batch.equal(reference.read_batch(100))  # concurrency does not change batches
+
+    stats = sampler.stats()
+    print(stats["num_active_workers"], stats["io_queue_depth"])
+    assert 1 <= stats["num_active_workers"] <= len(stats["workers"])
+    assert 4 <= stats["io_queue_depth"] <= 64
+    assert reference.stats()["num_active_workers"] == 8 and reference.stats()["io_queue_depth"] == 64
+
+
 test_sampler(num_rows=100_000, row_size_b=1016, num_samples=25 * 100_000)
 
 for row_size_b in range(288, 2001, 4):
     test_sampler(num_rows=100_000, row_size_b=row_size_b, num_samples=25 * 100_000)
+
+test_io_engine_sampler(num_rows=100_000, row_size_b=1016, num_batches=3000)
+test_io_engine_sampler(num_rows=100_000, row_size_b=1024, num_batches=3000)
+
+test_zero_copy_sampler(num_rows=100_000, row_size_b=1024, num_batches=3000)
+test_zero_copy_sampler(num_rows=25_000, row_size_b=4096, num_batches=3000)
+
+test_sharded_sampler(shard_rows=[40_000, 40_000, 40_000], row_size_b=1016, num_batches=30_000)
+test_sharded_sampler(shard_rows=[80_000, 30_000, 10_000], row_size_b=1016, num_batches=30_000)
+test_sharded_sampler(shard_rows=[60_000, 40_000], row_size_b=1024, num_batches=30_000)
+
+test_epoch_sampler(num_rows=100_000, row_size_b=1016, num_epochs=5)
+
+test_weighted_sampler(num_rows=100_000, row_size_b=1016, num_batches=10_000)
+
+test_projection_sampler(num_rows=100_000, row_size_b=1016, projection=[(0, 4), (1012, 4)], num_samples=100_000)
+test_projection_sampler(num_rows=100_000, row_size_b=4096, projection=[(2048, 1024), (0, 64)], num_samples=100_000)
+
+test_compressed_sampler(num_rows=100_000, row_size_b=1016, codec="lz4", num_samples=1_000_000)
+test_compressed_sampler(num_rows=100_000, row_size_b=1016, codec="zstd", num_samples=1_000_000)
+
+test_huge_pages_sampler(num_rows=100_000, row_size_b=1016, huge_pages="thp")
+test_huge_pages_sampler(num_rows=100_000, row_size_b=1016, huge_pages="1g")
+
+test_non_blocking_sampler(num_rows=100_000, row_size_b=1016, num_batches=5000)
+
+test_leased_sampler(num_rows=100_000, row_size_b=1016, num_batches=5000, num_leased=16)
+
+test_multi_consumer_sampler(num_rows=100_000, row_size_b=1016, num_consumers=4, num_batches=5000)
+
+test_sampler_server(num_rows=100_000, row_size_b=1016, num_clients=3, num_batches=2000)
+
+test_deterministic_sampler(num_rows=100_000, row_size_b=1016, num_batches=3000)
+
+test_chunk_position_sampler(num_rows=100_000, row_size_b=1024, chunk_rows=40, num_samples=1_000_000)
+
+test_checkpoint_sampler(num_rows=100_000, row_size_b=1016, num_batches=3000, sampling_mode="random")
+test_checkpoint_sampler(num_rows=100_000, row_size_b=1016, num_batches=3000, sampling_mode="epoch")
+
+test_value_format_sampler(num_rows=20_000, num_columns=254, value_format="float16", num_batches=1000)
+test_value_format_sampler(num_rows=20_000, num_columns=254, value_format="bfloat16", num_batches=1000)
+test_value_format_sampler(num_rows=20_000, num_columns=1000, value_format="int8", num_batches=1000)
+
+test_submission_order_sampler(num_rows=100_000, row_size_b=1016, num_batches=3000)
+test_submission_order_sampler(num_rows=100_000, row_size_b=1024, num_batches=3000)
+
+test_auto_tune_sampler(num_rows=100_000, row_size_b=1016, num_batches=20_000)